@@ -6,12 +6,14 @@ $declare_object("bus")
 
 $start_struct("bus")
 	int var;
-	uint8_t *data;
+$inline_array("bus", "uint8_t", "data", 10)
 $end_struct("bus")
 
+#include "object_pool.h"
+$define_pool("bus")
+
 $start_define_new("bus")
-	obj->var = 10;
-	obj->data = calloc(obj->var, sizeof(uint8_t));
+	obj->var = OW_BUS_DATA_LENGTH;
 $end_define_new("bus")
 
 $define_ref("bus")
@@ -19,5 +21,4 @@ $define_ref("bus")
 $define_unref("bus")
 
 $start_define_free("bus")
-	free(obj->data);
 $end_define_free("bus")
@@ -0,0 +1,21 @@
+/* #define OW_ENABLE_STATS */
+/* #define OW_ENABLE_TRACE */
+/* #define OW_ENABLE_HISTORY */
+#define OW_ENGINE_QUEUE_LENGTH (4)
+/* Pin access bound at compile time, e.g. for pin PD3 on STM8:
+#define OW_STATIC_PINS
+#define OW_PIN_OUTPUT() (GPIOD->DDR |= GPIO_PIN_3)
+#define OW_PIN_INPUT() (GPIOD->DDR &= ~GPIO_PIN_3)
+#define OW_PIN_PULL_UP() (GPIOD->ODR |= GPIO_PIN_3)
+#define OW_PIN_PULL_DOWN() (GPIOD->ODR &= ~GPIO_PIN_3)
+#define OW_PIN_READ() ((GPIOD->IDR & GPIO_PIN_3) != 0)
+*/
+/* Objects taken from static pools instead of heap, sizes are maximal
+   numbers of live objects:
+#define OW_BUS_POOL_SIZE (1)
+#define OW_DEVICE_POOL_SIZE (2)
+#define OW_ENGINE_POOL_SIZE (1)
+*/
+/* Atomic reference counts and bus ownership for threaded hosts:
+#define OW_THREAD_SAFE
+*/
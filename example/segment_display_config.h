@@ -9,3 +9,28 @@ typedef GPIO_TypeDef *sd_port_t;
 typedef GPIO_Pin_TypeDef sd_pin_t;
 typedef GPIO_Mode_TypeDef sd_pin_config_t;
 
+
+/* #define SD_ENABLE_TRACE */
+/* #define SD_ENABLE_PORT_MASKS */
+typedef unsigned char sd_port_mask_t;
+/* #define SD_ENABLE_BRIGHTNESS */
+/* #define SD_ENABLE_SHIFT_REGISTER */
+/* #define SD_ENABLE_SEGMENT_SCAN */
+/* #define SD_ENABLE_SCHEDULER */
+/* Pin access bound at compile time:
+#define SD_STATIC_PINS
+#define SD_INIT_DIGIT(port, pin, cfg) GPIO_Init(port, pin, cfg)
+#define SD_TURN_ON_DIGIT(port, pin) ((port)->ODR &= ~(pin))
+#define SD_TURN_OFF_DIGIT(port, pin) ((port)->ODR |= (pin))
+#define SD_INIT_SEGMENT(port, pin, cfg) GPIO_Init(port, pin, cfg)
+#define SD_TURN_ON_SEGMENT(port, pin) ((port)->ODR |= (pin))
+#define SD_TURN_OFF_SEGMENT(port, pin) ((port)->ODR &= ~(pin))
+*/
+/* Objects taken from static pools instead of heap:
+#define SD_DISPLAY_POOL_SIZE (1)
+#define SD_SCHEDULER_POOL_SIZE (1)
+*/
+#define SD_MAX_DIGITS (4)
+/* Atomic reference counts and fenced publishing for threaded hosts:
+#define SD_THREAD_SAFE
+*/
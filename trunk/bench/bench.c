@@ -0,0 +1,214 @@
+/* bench.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench.c
+  Benchmark runner, built and run on host with make run in bench
+  directory.
+
+  Usage: bench_run [-b baseline] [-t percent] [-v file] [filter]
+
+  Every benchmark prints one tab separated line: name, iterations,
+  nanoseconds, cycles, pin callbacks and mocked clock ticks per
+  operation. Cycles are 0 where the time stamp counter is not
+  available. Output saved from an earlier run can be passed as
+  baseline, then the run fails if callbacks or ticks of any benchmark
+  grew or its time grew by more than percent (10 by default). Only
+  benchmarks with filter in their names are run. Built with
+  PT_ENABLE_VCD (make vcd), -v writes pin trace of a 1wire
+  transaction on the mocked clock to file and no benchmarks are run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() ((double)__rdtsc())
+#else
+#define BENCH_CYCLES() (0.0)
+#endif
+
+#include "bench.h"
+
+#define BENCH_MIN_NS (20e6) /* length of one measured run */
+#define BENCH_REPEATS (5) /* best of the runs is reported */
+#define BENCH_MAX_BASELINE (64)
+#define BENCH_NAME_LENGTH (48)
+
+unsigned long bench_calls;
+unsigned long bench_ticks;
+volatile unsigned bench_sink;
+
+struct bench_result {
+  char name[BENCH_NAME_LENGTH];
+  double ns, cycles, calls, ticks;
+};
+
+static const char *bench_filter;
+static struct bench_result baseline[BENCH_MAX_BASELINE];
+static int baseline_count;
+static double tolerance = 10;
+static int regressions;
+
+static double bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static int bench_load_baseline(const char *path) {
+  FILE *in;
+  char line[256];
+  struct bench_result *result;
+  unsigned long iterations;
+  in = fopen(path, "r");
+  if (in == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), in) != NULL
+	 && baseline_count < BENCH_MAX_BASELINE) {
+    if (line[0] == '#') {
+      continue;
+    }
+    result = &baseline[baseline_count];
+    if (sscanf(line, "%47s %lu %lf %lf %lf %lf", result->name,
+	       &iterations, &result->ns, &result->cycles, &result->calls,
+	       &result->ticks) == 6) {
+      baseline_count++;
+    }
+  }
+  fclose(in);
+  return 0;
+}
+
+static void bench_compare(const struct bench_result *result) {
+  int i;
+  const struct bench_result *old;
+  for (i = 0; i < baseline_count; ++i) {
+    old = &baseline[i];
+    if (strcmp(old->name, result->name) != 0) {
+      continue;
+    }
+    // counts are exact, time is noisy
+    if (result->calls > old->calls || result->ticks > old->ticks
+	|| result->ns > old->ns * (1 + tolerance / 100)) {
+      fprintf(stderr, "regression %s: %.2f ns %.2f calls %.2f ticks, "
+	      "was %.2f ns %.2f calls %.2f ticks\n", result->name,
+	      result->ns, result->calls, result->ticks, old->ns,
+	      old->calls, old->ticks);
+      regressions++;
+    }
+    return;
+  }
+}
+
+void bench_run(const char *name, bench_fn fn) {
+  struct bench_result result;
+  unsigned long iterations = 1;
+  double start, ns, cycles;
+  int i;
+  if (bench_filter != NULL && strstr(name, bench_filter) == NULL) {
+    return;
+  }
+  // grow the run till it is long enough to be timed
+  for (;;) {
+    start = bench_now();
+    fn(iterations);
+    if (bench_now() - start >= BENCH_MIN_NS / 4) {
+      break;
+    }
+    iterations *= 2;
+  }
+  iterations *= 4;
+  strncpy(result.name, name, BENCH_NAME_LENGTH - 1);
+  result.name[BENCH_NAME_LENGTH - 1] = '\0';
+  result.ns = result.cycles = -1;
+  for (i = 0; i < BENCH_REPEATS; ++i) {
+    bench_calls = bench_ticks = 0;
+    cycles = BENCH_CYCLES();
+    start = bench_now();
+    fn(iterations);
+    ns = bench_now() - start;
+    cycles = BENCH_CYCLES() - cycles;
+    if (result.ns < 0 || ns < result.ns) {
+      result.ns = ns;
+    }
+    if (result.cycles < 0 || cycles < result.cycles) {
+      result.cycles = cycles;
+    }
+  }
+  result.ns /= iterations;
+  result.cycles /= iterations;
+  result.calls = (double)bench_calls / iterations;
+  result.ticks = (double)bench_ticks / iterations;
+  printf("%s\t%lu\t%.2f\t%.2f\t%.2f\t%.2f\n", result.name, iterations,
+	 result.ns, result.cycles, result.calls, result.ticks);
+  fflush(stdout);
+  bench_compare(&result);
+}
+
+#ifdef PT_ENABLE_VCD
+static int bench_write_vcd(const char *path) {
+  FILE *out;
+  int rc;
+  out = fopen(path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "can not write %s\n", path);
+    return 2;
+  }
+  rc = bench_one_wire_vcd(out);
+  if (fclose(out) != 0 || rc < 0) {
+    fprintf(stderr, "can not write trace to %s\n", path);
+    return 2;
+  }
+  return 0;
+}
+#endif
+
+int main(int argc, char **argv) {
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      if (bench_load_baseline(argv[++i]) < 0) {
+	fprintf(stderr, "can not read baseline %s\n", argv[i]);
+	return 2;
+      }
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+#ifdef PT_ENABLE_VCD
+    } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+      return bench_write_vcd(argv[++i]);
+#endif
+    } else if (argv[i][0] != '-') {
+      bench_filter = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [-b baseline] [-t percent] [-v file] "
+	      "[filter]\n", argv[0]);
+      return 2;
+    }
+  }
+  printf("# name\titerations\tns/op\tcycles/op\tcalls/op\tticks/op\n");
+  bench_timer_delay();
+  bench_one_wire();
+  bench_segment_display();
+  bench_temperature_filter();
+  bench_virtual_display();
+  return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+/* bench.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench.h
+  Host benchmarks of the library hot paths.
+
+  A benchmark is a function running its operation given number of
+  times. It counts callbacks into pin functions in bench_calls and
+  ticks of the mocked clock in bench_ticks, these numbers do not
+  depend on the host and must not grow unnoticed. Time is measured
+  with the host monotonic clock and, on x86, with the time stamp
+  counter.
+*/
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+/*! Run the operation iterations times. */
+typedef void (*bench_fn)(unsigned long iterations);
+
+extern unsigned long bench_calls;
+extern unsigned long bench_ticks;
+/*! Results are stored here so the compiler keeps the operations. */
+extern volatile unsigned bench_sink;
+
+/*! Measure fn and print one result line, see bench.c for format. */
+void bench_run(const char *name, bench_fn fn);
+
+void bench_timer_delay(void);
+void bench_one_wire(void);
+void bench_segment_display(void);
+void bench_temperature_filter(void);
+void bench_virtual_display(void);
+
+#ifdef PT_ENABLE_VCD
+#include <stdio.h>
+/*! Write pin trace of one 1wire rom read and conversion. */
+int bench_one_wire_vcd(FILE *out);
+#endif
+
+#endif /* BENCH_H_ */
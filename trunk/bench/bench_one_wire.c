@@ -0,0 +1,272 @@
+/* bench_one_wire.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench_one_wire.c
+  1wire benchmarks. Transactions run against a scripted DS18B20: the
+  read pin function returns presence, released bus and then the bits
+  the sensor would send, writes are ignored. The clock counts one tick
+  per read and jumps over waits reported by the bus, so tick counts
+  are bus time in usec.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "one_wire.h"
+
+#define BENCH_OW_PERIOD (60000)
+#define BENCH_OW_SCRIPT_LENGTH (2 + 8*OW_SCRATCHPAD_LENGTH)
+
+struct bench_ow_script {
+  uint8_t bits[BENCH_OW_SCRIPT_LENGTH];
+  int length;
+};
+
+static unsigned long clock_ticks;
+static struct bench_ow_script rom_script, scratchpad_script,
+  convert_script;
+static const struct bench_ow_script *script;
+static int script_bit;
+
+static struct td_timer timer;
+static struct ow_bus *bus;
+static struct ow_device *device;
+static struct ow_engine *engine;
+
+static TD_TIMER_TYPE bench_ow_counter(void) {
+  clock_ticks++;
+  return clock_ticks % BENCH_OW_PERIOD;
+}
+
+static void bench_ow_pin(void) {
+  bench_calls++;
+}
+
+static uint_fast8_t bench_ow_read(void) {
+  bench_calls++;
+  if (script_bit < script->length) {
+    return script->bits[script_bit++];
+  }
+  return 1;
+}
+
+/* Reset response followed by data bytes LSB first. */
+static void bench_ow_make_script(struct bench_ow_script *out,
+				 const uint8_t *data, int length) {
+  int i;
+  out->bits[0] = 0;
+  out->bits[1] = 1;
+  for (i = 0; i < 8*length; ++i) {
+    out->bits[2 + i] = (data[i / 8] >> (i % 8)) & 0x1;
+  }
+  out->length = 2 + 8*length;
+}
+
+static void bench_ow_check(const char *what, int_fast8_t rc) {
+  if (rc != 0) {
+    fprintf(stderr, "%s failed with %d\n", what, rc);
+    exit(2);
+  }
+}
+
+static void bench_ow_setup(void) {
+  uint8_t rom[OW_ADDRESS_LENGTH] = {0x28, 0xff, 0x4c, 0x6e, 0x61, 0x16, 0x04};
+  /* 25.0625 C, alarms and 12 bit configuration */
+  uint8_t scratchpad[OW_SCRATCHPAD_LENGTH] = {0x91, 0x01, 0x4b, 0x46, 0x7f,
+					      0xff, 0x0f, 0x10};
+  /* conversion is done after the third poll */
+  static const uint8_t polls[] = {0x08};
+  rom[OW_ADDRESS_LENGTH - 1] = ow_crc(rom, OW_ADDRESS_LENGTH - 1);
+  scratchpad[OW_SCRATCHPAD_LENGTH - 1] =
+    ow_crc(scratchpad, OW_SCRATCHPAD_LENGTH - 1);
+  bench_ow_make_script(&rom_script, rom, OW_ADDRESS_LENGTH);
+  bench_ow_make_script(&scratchpad_script, scratchpad, OW_SCRATCHPAD_LENGTH);
+  bench_ow_make_script(&convert_script, polls, 1);
+  convert_script.length = 2 + 4;
+
+  td_init(&timer, bench_ow_counter, BENCH_OW_PERIOD);
+  bench_ow_check("bus", ow_bus_new(&bus));
+  ow_bus_set_timer(bus, &timer);
+  ow_bus_set_output_fn(bus, bench_ow_pin);
+  ow_bus_set_input_fn(bus, bench_ow_pin);
+  ow_bus_set_pull_up_fn(bus, bench_ow_pin);
+  ow_bus_set_pull_down_fn(bus, bench_ow_pin);
+  ow_bus_set_read_fn(bus, bench_ow_read);
+  bench_ow_check("device", ow_device_new(&device));
+  ow_device_set_bus(device, bus);
+  bench_ow_check("engine", ow_engine_new(&engine));
+}
+
+static void bench_ow_teardown(void) {
+  ow_engine_unref(engine);
+  ow_device_unref(device);
+  ow_bus_unref(bus);
+}
+
+/* Run started transaction to the end on the mocked clock. */
+static int_fast8_t bench_ow_complete(int_fast8_t rc) {
+  unsigned long start = clock_ticks;
+  while (rc > 0) {
+    clock_ticks += ow_bus_get_wait(bus);
+    rc = ow_device_continue(device);
+  }
+  bench_ticks += clock_ticks - start;
+  return rc;
+}
+
+static void bench_ow_crc_rom(unsigned long iterations) {
+  uint8_t data[OW_ADDRESS_LENGTH] = {0x28, 0xff, 0x4c, 0x6e, 0x61, 0x16, 0x04};
+  unsigned long i;
+  unsigned sum = 0;
+  for (i = 0; i < iterations; ++i) {
+    data[1] = (uint8_t)i;
+    sum += ow_crc(data, OW_ADDRESS_LENGTH);
+  }
+  bench_sink = sum;
+}
+
+static void bench_ow_crc_scratchpad(unsigned long iterations) {
+  uint8_t data[OW_SCRATCHPAD_LENGTH] = {0x91, 0x01, 0x4b, 0x46, 0x7f, 0xff,
+					0x0f, 0x10};
+  unsigned long i;
+  unsigned sum = 0;
+  for (i = 0; i < iterations; ++i) {
+    data[0] = (uint8_t)i;
+    sum += ow_crc(data, OW_SCRATCHPAD_LENGTH);
+  }
+  bench_sink = sum;
+}
+
+static void bench_ow_calculate_temperature(unsigned long iterations) {
+  unsigned long i;
+  unsigned sum = 0;
+  int16_t raw;
+  int8_t int_part;
+  uint8_t frac_part;
+  for (i = 0; i < iterations; ++i) {
+    /* DS18B20 range from -55 to 125 C */
+    raw = (int16_t)(i % 2880) - 880;
+    ow_calculate_temperature((uint8_t)raw, (uint8_t)(raw >> 8),
+			     &int_part, &frac_part);
+    sum += int_part + frac_part;
+  }
+  bench_sink = sum;
+}
+
+static void bench_ow_read_rom(unsigned long iterations) {
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    script = &rom_script;
+    script_bit = 0;
+    bench_ow_check("read rom",
+		   bench_ow_complete(ow_device_read_rom(device)));
+  }
+  bench_sink = ow_device_get_address(device)[0];
+}
+
+static void bench_ow_read_scratchpad(unsigned long iterations) {
+  uint8_t scratchpad[OW_SCRATCHPAD_LENGTH];
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    script = &scratchpad_script;
+    script_bit = 0;
+    bench_ow_check("read scratchpad", bench_ow_complete(
+		     ow_device_read_scratchpad(device, scratchpad)));
+  }
+  bench_sink = scratchpad[0];
+}
+
+static void bench_ow_convert_temperature(unsigned long iterations) {
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    script = &convert_script;
+    script_bit = 0;
+    bench_ow_check("convert temperature", bench_ow_complete(
+		     ow_device_convert_temperature(device)));
+  }
+}
+
+/* Conversion and readout queued to the engine, as the main loop of a
+   thermometer does it. */
+static void bench_ow_engine_measure(unsigned long iterations) {
+  uint8_t scratchpad[OW_SCRATCHPAD_LENGTH];
+  struct ow_transaction transaction = {0};
+  unsigned long i, start;
+  TD_TIMER_TYPE wait;
+  for (i = 0; i < iterations; ++i) {
+    start = clock_ticks;
+    transaction.device = device;
+    transaction.data = scratchpad;
+    transaction.type = OW_TRANSACTION_CONVERT_TEMPERATURE;
+    ow_engine_submit(engine, &transaction);
+    transaction.type = OW_TRANSACTION_READ_SCRATCHPAD;
+    ow_engine_submit(engine, &transaction);
+    script = &convert_script;
+    script_bit = 0;
+    while ((wait = ow_engine_service(engine)) > 0) {
+      if (script == &convert_script && script_bit == script->length) {
+	script = &scratchpad_script;
+	script_bit = 0;
+      }
+      clock_ticks += wait;
+    }
+    while (ow_engine_collect(engine, &transaction) == 0) {
+      bench_ow_check("engine", transaction.rc);
+    }
+    bench_ticks += clock_ticks - start;
+  }
+  bench_sink = scratchpad[0];
+}
+
+#ifdef PT_ENABLE_VCD
+int bench_one_wire_vcd(FILE *out) {
+  static const char *const names[] = {"ow_line", "ow_sample"};
+  static struct pt_buffer trace;
+  int rc;
+  bench_ow_setup();
+  pt_init(&trace, &timer);
+  ow_bus_set_trace(bus, &trace, 0);
+  script = &rom_script;
+  script_bit = 0;
+  bench_ow_check("read rom", bench_ow_complete(ow_device_read_rom(device)));
+  script = &convert_script;
+  script_bit = 0;
+  bench_ow_check("convert temperature", bench_ow_complete(
+		   ow_device_convert_temperature(device)));
+  ow_bus_set_trace(bus, NULL, 0);
+  rc = pt_write_vcd(out, &trace, names, 2, "1us");
+  bench_ow_teardown();
+  return rc;
+}
+#endif
+
+void bench_one_wire(void) {
+  bench_ow_setup();
+  bench_run("ow_crc/rom", bench_ow_crc_rom);
+  bench_run("ow_crc/scratchpad", bench_ow_crc_scratchpad);
+  bench_run("ow_calculate_temperature", bench_ow_calculate_temperature);
+  script = &rom_script;
+  script_bit = 0;
+  bench_ow_check("read rom", bench_ow_complete(ow_device_read_rom(device)));
+  bench_run("ow_device/read_rom", bench_ow_read_rom);
+  bench_run("ow_device/read_scratchpad", bench_ow_read_scratchpad);
+  bench_run("ow_device/convert_temperature", bench_ow_convert_temperature);
+  bench_run("ow_engine/convert_and_read", bench_ow_engine_measure);
+  bench_ow_teardown();
+}
@@ -0,0 +1,139 @@
+/* bench_segment_display.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench_segment_display.c
+  Refresh and number formatting of an 8 digit display. Segments are
+  bits 0-7 of port 0, digits bits 0-7 of port 1, in shift register
+  mode they are outputs of the segment and the digit byte.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "segment_display.h"
+
+#define BENCH_SD_DIGITS (8)
+
+static sd_port_mask_t ports[2];
+
+static void bench_sd_on(sd_port_t port, sd_pin_t pin) {
+  ports[port] |= pin;
+  bench_calls++;
+}
+
+static void bench_sd_off(sd_port_t port, sd_pin_t pin) {
+  ports[port] &= ~pin;
+  bench_calls++;
+}
+
+static void bench_sd_write_port(sd_port_t port, sd_port_mask_t set,
+                                sd_port_mask_t reset) {
+  ports[port] = (ports[port] | set) & ~reset;
+  bench_calls++;
+}
+
+static void bench_sd_shift_out(const uint8_t *data, uint_fast8_t length) {
+  ports[0] = data[0];
+  ports[1] = data[length - 1];
+  bench_calls++;
+}
+
+// Display showing 1234.5678, outputs are numbers or port bits.
+static struct sd_display *bench_sd_create(int outputs) {
+  struct sd_display *display;
+  struct sd_segment segments[SD_SEGMENTS_PER_DIGIT];
+  struct sd_segment digits[BENCH_SD_DIGITS];
+  int i;
+  if (sd_new(&display) != 0) {
+    fprintf(stderr, "can not create display\n");
+    exit(2);
+  }
+  for (i = 0; i < SD_SEGMENTS_PER_DIGIT; ++i) {
+    segments[i].port = 0;
+    segments[i].pin = outputs ? (sd_pin_t)i : 1u << i;
+    segments[i].config = 0;
+  }
+  for (i = 0; i < BENCH_SD_DIGITS; ++i) {
+    digits[i].port = 1;
+    digits[i].pin = outputs ? (sd_pin_t)i : 1u << i;
+    digits[i].config = 0;
+  }
+  sd_set_digit_functions(display, sd_init_plug, bench_sd_on, bench_sd_off);
+  sd_set_segment_functions(display, sd_init_plug, bench_sd_on,
+                           bench_sd_off);
+  sd_set_digit_map(display, BENCH_SD_DIGITS, digits);
+  sd_set_segment_map(display, segments);
+  sd_init(display);
+  sd_display_uint(display, 0, BENCH_SD_DIGITS - 1, 12345678);
+  sd_set_dot_position(display, 4);
+  sd_publish(display);
+  return display;
+}
+
+static struct sd_display *current;
+
+static void bench_sd_show_next(unsigned long iterations) {
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    sd_show_next(current);
+  }
+  bench_sink = ports[0];
+}
+
+static void bench_sd_show(const char *name, struct sd_display *display) {
+  current = display;
+  bench_run(name, bench_sd_show_next);
+  sd_unref(display);
+}
+
+static void bench_sd_display_uint(unsigned long iterations) {
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    sd_display_uint(current, 0, 3, (unsigned)i % 10000);
+  }
+}
+
+static void bench_sd_display_uint_8(unsigned long iterations) {
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    sd_display_uint(current, 0, 7, (unsigned)(i * 7919) % 100000000);
+  }
+}
+
+void bench_segment_display(void) {
+  struct sd_display *display;
+  bench_sd_show("sd_show_next/pins", bench_sd_create(0));
+  display = bench_sd_create(0);
+  sd_set_port_function(display, bench_sd_write_port, 0);
+  bench_sd_show("sd_show_next/ports", display);
+  display = bench_sd_create(0);
+  sd_set_port_function(display, bench_sd_write_port, SD_PORT_DIFF);
+  bench_sd_show("sd_show_next/ports_diff", display);
+  display = bench_sd_create(1);
+  sd_set_shift_function(display, bench_sd_shift_out, 0);
+  bench_sd_show("sd_show_next/shift", display);
+  display = bench_sd_create(0);
+  sd_set_scan_mode(display, SD_SCAN_SEGMENTS);
+  bench_sd_show("sd_show_next/segment_scan", display);
+
+  current = bench_sd_create(0);
+  bench_run("sd_display_uint/4", bench_sd_display_uint);
+  bench_run("sd_display_uint/8", bench_sd_display_uint_8);
+  sd_unref(current);
+}
@@ -0,0 +1,62 @@
+/* bench_temperature_filter.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench_temperature_filter.c
+  Filter update of all sensors of a gateway, TF_MAX_SENSORS is set by
+  the build command. Readings wander around 25 C with an occasional
+  failed reading and a power-on value.
+*/
+
+#include "bench.h"
+#include "temperature_filter.h"
+
+#define BENCH_TF_ROUNDS (64) /* must be a power of 2 */
+
+static int16_t readings[BENCH_TF_ROUNDS][TF_MAX_SENSORS];
+
+static void bench_tf_readings(void) {
+  uint32_t seed = 1;
+  int round, sensor;
+  for (sensor = 0; sensor < TF_MAX_SENSORS; ++sensor) {
+    readings[0][sensor] = 400;
+  }
+  for (round = 1; round < BENCH_TF_ROUNDS; ++round) {
+    for (sensor = 0; sensor < TF_MAX_SENSORS; ++sensor) {
+      seed = seed * 1103515245 + 12345;
+      readings[round][sensor] = readings[round - 1][sensor]
+	+ (int16_t)((seed >> 16) % 9) - 4;
+    }
+  }
+  readings[BENCH_TF_ROUNDS / 2][0] = TF_NO_VALUE;
+  readings[BENCH_TF_ROUNDS / 4][1] = TF_POWER_ON_VALUE;
+}
+
+static void bench_tf_update(unsigned long iterations) {
+  struct tf_bank bank;
+  unsigned long i;
+  tf_init(&bank, TF_MAX_SENSORS, 16);
+  for (i = 0; i < iterations; ++i) {
+    tf_update(&bank, readings[i & (BENCH_TF_ROUNDS - 1)]);
+  }
+  bench_sink = tf_get_output(&bank)[0];
+}
+
+void bench_temperature_filter(void) {
+  bench_tf_readings();
+  bench_run("tf_update/all_sensors", bench_tf_update);
+}
@@ -0,0 +1,71 @@
+/* bench_timer_delay.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench_timer_delay.c
+  Timer checks with a counter that wraps around during the run.
+*/
+
+#include "bench.h"
+#include "timer_delay.h"
+
+#define BENCH_TD_PERIOD (999)
+#define BENCH_TD_STEP (7)
+
+static TD_TIMER_TYPE counter;
+
+static TD_TIMER_TYPE bench_td_counter(void) {
+  counter += BENCH_TD_STEP;
+  if (counter > BENCH_TD_PERIOD) {
+    counter -= BENCH_TD_PERIOD + 1;
+  }
+  return counter;
+}
+
+static void bench_td_has_elapsed(unsigned long iterations) {
+  struct td_timer timer;
+  unsigned long i;
+  unsigned sum = 0;
+  td_init(&timer, bench_td_counter, BENCH_TD_PERIOD);
+  for (i = 0; i < iterations; ++i) {
+    // restart every 64 calls, so start moves around the period
+    if ((i & 0x3f) == 0) {
+      td_start(&timer);
+    }
+    sum += td_has_elapsed(&timer, 200) > 0;
+  }
+  bench_sink = sum;
+}
+
+static void bench_td_get_elapsed(unsigned long iterations) {
+  struct td_timer timer;
+  unsigned long i;
+  unsigned sum = 0;
+  td_init(&timer, bench_td_counter, BENCH_TD_PERIOD);
+  for (i = 0; i < iterations; ++i) {
+    if ((i & 0x3f) == 0) {
+      td_start(&timer);
+    }
+    sum += td_get_elapsed(&timer);
+  }
+  bench_sink = sum;
+}
+
+void bench_timer_delay(void) {
+  bench_run("td_has_elapsed", bench_td_has_elapsed);
+  bench_run("td_get_elapsed", bench_td_get_elapsed);
+}
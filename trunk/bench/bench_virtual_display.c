@@ -0,0 +1,111 @@
+/* bench_virtual_display.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file bench_virtual_display.c
+  Refresh of an 8 digit display checked on the virtual LED matrix.
+  Pin callbacks and virtual time are counted by virtual_display, a
+  step takes BENCH_VD_STEP ticks of 1 usec and every pin call one
+  tick. Runs fail on ghosts or on a frame count that does not match
+  the scan.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "virtual_display.h"
+
+#define BENCH_VD_DIGITS (8)
+#define BENCH_VD_STEP (1000)
+
+static struct vd_display virtual;
+static struct sd_display *current;
+static unsigned long steps_per_frame;
+
+static void bench_vd_create(void) {
+  struct sd_segment segments[SD_SEGMENTS_PER_DIGIT];
+  struct sd_segment digits[BENCH_VD_DIGITS];
+  int i;
+  for (i = 0; i < SD_SEGMENTS_PER_DIGIT; ++i) {
+    segments[i].port = 0;
+    segments[i].pin = 1u << i;
+    segments[i].config = 0;
+  }
+  for (i = 0; i < BENCH_VD_DIGITS; ++i) {
+    digits[i].port = 1;
+    digits[i].pin = 1u << i;
+    digits[i].config = 0;
+  }
+  if (sd_new(&current) != 0
+      || vd_init(&virtual, BENCH_VD_DIGITS, digits, segments, 1000000) != 0) {
+    fprintf(stderr, "can not create display\n");
+    exit(2);
+  }
+  vd_set_callback_cost(&virtual, 1);
+  vd_attach(&virtual);
+  sd_set_digit_functions(current, vd_init_pin, vd_digit_on, vd_digit_off);
+  sd_set_segment_functions(current, vd_init_pin, vd_segment_on,
+                           vd_segment_off);
+  sd_set_digit_map(current, BENCH_VD_DIGITS, digits);
+  sd_set_segment_map(current, segments);
+  sd_init(current);
+  sd_display_uint(current, 0, BENCH_VD_DIGITS - 1, 12345678);
+  sd_set_dot_position(current, 4);
+  sd_publish(current);
+}
+
+static void bench_vd_show_next(unsigned long iterations) {
+  struct vd_metrics metrics;
+  unsigned long i, frames;
+  vd_reset_metrics(&virtual);
+  for (i = 0; i < iterations; ++i) {
+    vd_show_next(&virtual, current, BENCH_VD_STEP);
+  }
+  vd_get_metrics(&virtual, &metrics);
+  // run may start anywhere in the scan
+  frames = iterations / steps_per_frame;
+  if (metrics.ghosts > 0 || metrics.frames < frames
+      || metrics.frames > frames + 1) {
+    fprintf(stderr, "virtual display: %lu steps gave %lu frames and "
+            "%lu ghosts\n", iterations, (unsigned long)metrics.frames,
+            (unsigned long)metrics.ghosts);
+    exit(2);
+  }
+  bench_calls += metrics.callbacks;
+  bench_ticks += metrics.time;
+  bench_sink = metrics.frames;
+}
+
+static void bench_vd_show(const char *name) {
+  struct vd_metrics metrics;
+  bench_run(name, bench_vd_show_next);
+  vd_get_metrics(&virtual, &metrics);
+  printf("# %s refresh %.1f Hz, %.2f callbacks per frame\n", name,
+         metrics.refresh_rate, metrics.callbacks_per_frame);
+  sd_unref(current);
+}
+
+void bench_virtual_display(void) {
+  bench_vd_create();
+  steps_per_frame = BENCH_VD_DIGITS;
+  bench_vd_show("vd_show_next/pins");
+  bench_vd_create();
+  sd_set_scan_mode(current, SD_SCAN_SEGMENTS);
+  steps_per_frame = SD_SEGMENTS_PER_DIGIT;
+  bench_vd_show("vd_show_next/segment_scan");
+}
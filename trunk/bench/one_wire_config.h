@@ -0,0 +1,3 @@
+/* Host configuration of the benchmarks. */
+#include <stdint.h>
+#define OW_ENGINE_QUEUE_LENGTH (4)
@@ -0,0 +1,13 @@
+/* Host configuration of the benchmarks, modes that are switched at
+   run time are compiled in. */
+#include <stdint.h>
+
+typedef int sd_port_t;
+typedef unsigned sd_pin_t;
+typedef int sd_pin_config_t;
+
+#define SD_ENABLE_PORT_MASKS
+typedef unsigned sd_port_mask_t;
+#define SD_ENABLE_SHIFT_REGISTER
+#define SD_ENABLE_SEGMENT_SCAN
+#define SD_MAX_DIGITS (8)
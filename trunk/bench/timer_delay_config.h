@@ -0,0 +1,2 @@
+/* Host configuration of the benchmarks, timer ticks are usec. */
+#define TD_TIMER_TYPE unsigned short
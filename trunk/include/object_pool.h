@@ -0,0 +1,76 @@
+/* object_pool.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file object_pool.h
+  Static object pools used instead of calloc and free.
+
+  OBJECT_POOL(ow_bus, struct ow_bus, OW_BUS_POOL_SIZE) defines an
+  array of size slots and two functions: ow_bus_pool_take returns a
+  zeroed object or NULL when all slots are taken, ow_bus_pool_give
+  returns an object to the pool, or -1 if it is not a taken object of
+  this pool, e.g. freed twice. The free list is used first, then never
+  used slots, so no initialisation pass is needed. Free slots keep the
+  list link in the object storage. Pools are not locked.
+
+  Sources use it under #ifdef of the size macro, objects generated
+  with define_pool from template/c_object.inc do the same and need
+  this header included by the source.
+*/
+
+#ifndef OBJECT_POOL_H_
+#define OBJECT_POOL_H_
+
+#include <string.h>
+
+#define OBJECT_POOL(name, type, size)					\
+  static struct name##_slot {						\
+    union {								\
+      type obj;								\
+      struct name##_slot *next;						\
+    } u;								\
+    unsigned char used;							\
+  } name##_slots[size];							\
+  static struct name##_slot *name##_free_slots;				\
+  static unsigned name##_used_slots;					\
+  static type *name##_pool_take(void) {					\
+    struct name##_slot *slot;						\
+    if (name##_free_slots) {						\
+      slot = name##_free_slots;						\
+      name##_free_slots = slot->u.next;					\
+    } else if (name##_used_slots < (size)) {				\
+      slot = &name##_slots[name##_used_slots++];			\
+    } else {								\
+      return NULL;							\
+    }									\
+    memset(slot, 0, sizeof(*slot));					\
+    slot->used = 1;							\
+    return &slot->u.obj;						\
+  }									\
+  static int name##_pool_give(type *obj) {				\
+    struct name##_slot *slot = (struct name##_slot *)obj;		\
+    if (slot < name##_slots || slot >= name##_slots + name##_used_slots \
+	|| !slot->used) {						\
+      return -1;							\
+    }									\
+    slot->used = 0;							\
+    slot->u.next = name##_free_slots;					\
+    name##_free_slots = slot;						\
+    return 0;								\
+  }
+
+#endif /* OBJECT_POOL_H_ */
@@ -25,33 +25,120 @@
 
 #include "stdint.h"
 
+#include "one_wire_config.h"
+
 #include "timer_delay.h"
+#ifdef OW_ENABLE_TRACE
+#include "pin_trace.h"
+#endif
+#ifdef OW_ENABLE_HISTORY
+#include "sample_history.h"
+#endif
+
+/*! Error codes, functions return them negated. */
+enum ow_errors {
+  OW_ERROR = 1,
+  OW_ERROR_BUSY,
+  OW_ERROR_NOOP,
+  OW_ERROR_NO_RESPONSE,
+  OW_ERROR_BUS_DOWN,
+  OW_ERROR_CRC
+};
+
+#ifdef OW_ENABLE_STATS
+#ifndef OW_STATS_BINS
+#define OW_STATS_BINS (8)
+#endif
+#ifndef OW_STATS_LATENCY_SHIFT
+#define OW_STATS_LATENCY_SHIFT (10) /* latency bins count 1024 ticks */
+#endif
+/*! Bus and device health counters.
+
+  Counters wrap around. Histograms use power of 2 bins: bin 0 counts
+  zeros, bin n counts values in [2^(n-1), 2^n), the last bin counts
+  everything above. Overshoot is measured in timer ticks past each
+  slot deadline, latency in ticks shifted by OW_STATS_LATENCY_SHIFT
+  from transaction start till its end. Present only if
+  OW_ENABLE_STATS is defined in one_wire_config.h.
+ */
+struct ow_stats {
+  uint16_t resets;
+  uint16_t no_response;
+  uint16_t bus_down;
+  uint16_t crc_errors;
+  uint16_t retries; /* repeated by policy or failed one repeated by caller */
+  uint16_t busy;
+  uint16_t transactions;
+  uint16_t overshoot[OW_STATS_BINS]; /* bus only */
+  uint16_t latency[OW_STATS_BINS]; /* device only */
+};
+void ow_stats_clear(struct ow_stats *stats);
+#endif
+
+#define OW_SCRATCHPAD_LENGTH (9)
 
 uint8_t ow_crc(uint8_t *data, int length);
 int_fast8_t ow_calculate_temperature(uint8_t lsb, uint8_t msb, 
 				     int8_t *int_part, uint8_t *frac_part);
 /*! 1wire bus object. */
+/* Objects are not locked, a device is used by one thread at a time.
+   Devices sharing a bus take it for the whole transaction and get
+   -OW_ERROR_BUSY while another device holds it, direct ow_bus_*
+   calls bypass this and belong to single bus users. An engine is
+   used by one submitting and one servicing thread. With
+   OW_THREAD_SAFE in one_wire_config.h reference counts, bus
+   ownership and stats counters are atomic and engine queue indices
+   are published with acquire and release, so buses can be shared by
+   threads without locks. */
 struct ow_bus;
-/* Create and destruction. */
+/* Create and destruction. With OW_BUS_POOL_SIZE, OW_DEVICE_POOL_SIZE
+   or OW_ENGINE_POOL_SIZE in one_wire_config.h the objects are taken
+   from static pools, _new then fails when the pool is used up. Pools
+   are not locked, objects are created and freed from one context. */
 int_fast8_t ow_bus_new(struct ow_bus **bus);
 struct ow_bus *ow_bus_ref(struct ow_bus *bus);
 struct ow_bus *ow_bus_unref(struct ow_bus *bus);
 void ow_bus_free(struct ow_bus *bus);
-/* Init functions. */
+/* Init functions. With OW_STATIC_PINS in one_wire_config.h pins are
+   accessed through OW_PIN_OUTPUT(), OW_PIN_INPUT(), OW_PIN_PULL_UP(),
+   OW_PIN_PULL_DOWN() and OW_PIN_READ() macros of the config, pin
+   functions are not stored and their setters only check arguments.
+   All buses of the program then share the same pin. */
 int_fast8_t ow_bus_set_timer(struct ow_bus *bus, struct td_timer *timer);
 int_fast8_t ow_bus_set_output_fn(struct ow_bus *bus, void (*output_fn)(void));
 int_fast8_t ow_bus_set_input_fn(struct ow_bus *bus, void (*input_fn)(void));
 int_fast8_t ow_bus_set_pull_up_fn(struct ow_bus *bus, void (*pull_up_fn)(void));
 int_fast8_t ow_bus_set_pull_down_fn(struct ow_bus *bus, void (*pull_down_fn)(void));
 int_fast8_t ow_bus_set_read_fn(struct ow_bus *bus, uint_fast8_t (*read_fn)(void));
+#ifdef OW_ENABLE_STATS
+const struct ow_stats *ow_bus_get_stats(struct ow_bus *bus);
+#endif
+#ifdef OW_ENABLE_TRACE
+/*! Record line level as first_signal and samples as first_signal + 1,
+  pass NULL trace to stop recording. */
+int_fast8_t ow_bus_set_trace(struct ow_bus *bus, struct pt_buffer *trace,
+			     uint_fast8_t first_signal);
+#endif
 /* Interface functions. All 1wire operations are split into parts. An
    operations is started by calling one of operation functions. The
    control is returned from function as soon as break can be made. To
    continue operation ow_bus_continue function must be called
    repeatedly untill 0 or negative value is returned. Negative value
-   indicates error, 0 - successfully finished operation.
+   indicates error, 0 - successfully finished operation. Edges with
+   tight limits are timed inside of a call: a call busy waits up to
+   60 usec while writing a zero bit, 12 usec while reading a bit and
+   up to 240 usec after the reset pulse while waiting for presence
+   pulse (till the pulse starts, at most 60 usec, when a device
+   answers). Longer intervals are left to the caller, ow_bus_get_wait
+   tells how many timer ticks are left till the next step is due, so
+   ow_bus_continue can be called from a timer interrupt or polled from
+   main loop. A late call stretches the reset pulse or idle time
+   between slots, which the protocol allows, it must not be
+   interrupted for longer than a few usec while it busy waits.
+   Calling it earlier is harmless, 1 is returned.
  */
 int_fast8_t ow_bus_continue(struct ow_bus *bus);
+TD_TIMER_TYPE ow_bus_get_wait(struct ow_bus *bus);
 int_fast8_t ow_bus_terminate_operation(struct ow_bus *bus);
 /*! Reset 1wire bus and return number of usec the bus was down. */
 int_fast8_t ow_bus_reset(struct ow_bus *bus);
@@ -64,25 +151,134 @@ int_fast8_t ow_bus_read(struct ow_bus *bus, uint8_t *data);
 int_fast8_t ow_bus_read_next_bit(struct ow_bus *bus);
 
 int_fast8_t ow_bus_read_bit(struct ow_bus *bus);
+/*! Keep the bus busy for given number of timer ticks. */
+int_fast8_t ow_bus_delay(struct ow_bus *bus, TD_TIMER_TYPE delay);
+/*! Free the bus held low by a device.
+
+  Issues up to OW_BUS_RECOVER_SLOTS read slots till the line reads 1,
+  fails with -OW_ERROR_BUS_DOWN otherwise.
+ */
+int_fast8_t ow_bus_recover(struct ow_bus *bus);
+int_fast8_t ow_bus_recover_next_slot(struct ow_bus *bus);
+#ifndef OW_BUS_RECOVER_SLOTS
+#define OW_BUS_RECOVER_SLOTS (16)
+#endif
 
 #define OW_ADDRESS_LENGTH (8)
 
 /*! Stores address of 1 wire device. */
-/* struct ow_device; */
+struct ow_device;
 /* Create and destruction. */
 int_fast8_t ow_device_new(struct ow_device **device);
 struct ow_device *ow_device_ref(struct ow_device *device);
 struct ow_device *ow_device_unref(struct ow_device *device);
 void ow_device_free(struct ow_device *device);
+/*! Device takes its own reference to the bus and drops it when
+  freed, caller keeps and still has to unref its reference. Bus can
+  be set once. */
 int_fast8_t ow_device_set_bus(struct ow_device *device, struct ow_bus *bus);
+
+enum ow_retry_flags {
+  OW_RETRY_NO_RESPONSE = 0x1,
+  OW_RETRY_CRC = 0x2, /* read again data with wrong crc */
+  OW_RETRY_BUS_DOWN = 0x4 /* run ow_bus_recover before next attempt */
+};
+/*! Handling of failed device transactions.
+
+  Failed transaction is repeated from the reset up to attempts times
+  if its error is selected in flags. Before every repeated attempt the
+  bus is kept idle for backoff ticks, the wait doubles with each
+  attempt and never exceeds half of the bus timer period. Everything
+  happens inside ow_device_continue, the caller sees only the final
+  result. Default policy makes no retries.
+ */
+struct ow_retry_policy {
+  uint8_t attempts;
+  uint8_t flags;
+  TD_TIMER_TYPE backoff;
+};
+int_fast8_t ow_device_set_retry_policy(struct ow_device *device,
+				       const struct ow_retry_policy *policy);
+#ifdef OW_ENABLE_STATS
+const struct ow_stats *ow_device_get_stats(struct ow_device *device);
+#endif
+#ifdef OW_ENABLE_HISTORY
+/*! Record temperature of every successful read scratchpad, pass NULL
+  history to stop recording. Samples are taken from the scratchpad
+  passed to ow_device_read_scratchpad when the transaction ends, in
+  the context that runs ow_device_continue. The buffer index is not
+  published atomically, when the device is serviced by an engine
+  from the timer interrupt the main loop must mask that interrupt
+  around sh_reader_init, sh_reader_next, sh_get_count and sh_clear.
+ */
+int_fast8_t ow_device_set_history(struct ow_device *device,
+				  struct sh_buffer *history);
+#endif
 int_fast8_t ow_device_start_operation(struct ow_device *device);
 int_fast8_t ow_device_is_busy(struct ow_device *device);
 
 int_fast8_t ow_device_continue(struct ow_device *device);
 uint8_t *ow_device_get_address(struct ow_device *device);
+/*! Read rom and scratchpad fail with -OW_ERROR_CRC if received data is
+  damaged. */
 int_fast8_t  ow_device_read_rom(struct ow_device *device);
 int_fast8_t  ow_device_read_scratchpad(struct ow_device *device,
 				       uint8_t *scratchpad);
 int_fast8_t  ow_device_convert_temperature(struct ow_device *device);
+/* Conversion end is polled with one read slot per interval of timer
+   ticks (10 msec with 1 usec ticks), it must be shorter than timer
+   period. */
+#ifndef OW_DEVICE_POLL_INTERVAL
+#define OW_DEVICE_POLL_INTERVAL (10000)
+#endif
+
+#ifndef OW_ENGINE_QUEUE_LENGTH
+#define OW_ENGINE_QUEUE_LENGTH (4) /* must be a power of 2 */
+#endif
+
+enum ow_transaction_types {
+  OW_TRANSACTION_READ_ROM = 0,
+  OW_TRANSACTION_READ_SCRATCHPAD,
+  OW_TRANSACTION_CONVERT_TEMPERATURE
+};
+
+/*! Device operation passed through ow_engine queue. */
+struct ow_transaction {
+  struct ow_device *device;
+  uint8_t *data; /* scratchpad storage for read scratchpad */
+  uint8_t type;
+  int_fast8_t rc; /* set by engine, 0 or negative error */
+};
+
+/*! Interrupt driven 1wire engine.
+
+  Main loop submits transactions and collects results, timer interrupt
+  calls ow_engine_service which returns the number of ticks till the
+  next call or 0 if there is nothing to do. Queue is lock free, there
+  must be only one submitting/collecting context and only one
+  servicing one. All devices must share one bus.
+ */
+struct ow_engine;
+/* Create and destruction. */
+int_fast8_t ow_engine_new(struct ow_engine **engine);
+struct ow_engine *ow_engine_ref(struct ow_engine *engine);
+struct ow_engine *ow_engine_unref(struct ow_engine *engine);
+void ow_engine_free(struct ow_engine *engine);
+/*! Queue transaction, main loop side.
+
+  Return 1 if engine was idle and timer interrupt must be started, 0
+  if transaction was queued behind running one, -OW_ERROR_BUSY if
+  queue is full.
+ */
+int_fast8_t ow_engine_submit(struct ow_engine *engine,
+			     const struct ow_transaction *transaction);
+/*! Get finished transaction, main loop side.
+
+  Return -OW_ERROR_NOOP if nothing finished yet.
+ */
+int_fast8_t ow_engine_collect(struct ow_engine *engine,
+			      struct ow_transaction *transaction);
+/*! Make next step, interrupt side. */
+TD_TIMER_TYPE ow_engine_service(struct ow_engine *engine);
 
 #endif /* ONE_WIRE_H_ */
@@ -0,0 +1,88 @@
+/* pin_trace.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file pin_trace.h
+  Recorder of timestamped pin events.
+
+  Events are stored in a fixed size ring buffer, the oldest ones are
+  overwritten. Time stamps are raw counter values of a td_timer, they
+  are unwrapped when the trace is exported, so the gap between two
+  consecutive events must be shorter than the timer period. Recording
+  is not reentrant, all events must come from one context.
+*/
+
+#ifndef PIN_TRACE_H_
+#define PIN_TRACE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+
+#include "timer_delay.h"
+
+#ifndef PT_BUFFER_LENGTH
+#define PT_BUFFER_LENGTH (256) /* must be a power of 2 */
+#endif
+
+//! Value flag: signal returns to high impedance right after event.
+/*! Used to show samples as short pulses.
+ */
+#define PT_STROBE (0x2)
+
+struct pt_event {
+  TD_TIMER_TYPE time;
+  uint8_t signal;
+  uint8_t value; /* 0 or 1, optionally with PT_STROBE */
+};
+
+struct pt_buffer {
+  struct td_timer *timer;
+  uint_fast16_t head;
+  uint_fast16_t count;
+  struct pt_event events[PT_BUFFER_LENGTH];
+};
+
+//! Prepare empty buffer, time stamps are taken from the timer.
+int pt_init(struct pt_buffer *buffer, struct td_timer *timer);
+//! Drop all recorded events.
+int pt_clear(struct pt_buffer *buffer);
+//! Store event with current time.
+void pt_record(struct pt_buffer *buffer, uint_fast8_t signal,
+	       uint_fast8_t value);
+//! Get number of stored events.
+uint_fast16_t pt_get_count(const struct pt_buffer *buffer);
+//! Get stored event, index 0 is the oldest one.
+const struct pt_event *pt_get_event(const struct pt_buffer *buffer,
+				    uint_fast16_t index);
+
+#ifdef PT_ENABLE_VCD
+#include <stdio.h>
+//! Write trace as value change dump, host only.
+/*! Signal numbers index names array, events of signals without a
+  name are skipped. Timescale is a VCD string like "1us".
+ */
+int pt_write_vcd(FILE *out, const struct pt_buffer *buffer,
+		 const char *const *names, uint_fast8_t name_count,
+		 const char *timescale);
+#endif
+
+#ifdef __cplusplus
+} // extern C
+#endif
+#endif  // PIN_TRACE_H_
@@ -0,0 +1,99 @@
+/* sample_history.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file sample_history.h
+  Delta encoded history of timestamped temperature samples.
+
+  Samples are raw DS18B20 temperatures in 1/16 C. Every sample is
+  stored as two varints: ticks since the previous sample and zigzag
+  coded temperature change, usually 2 bytes instead of 4-6 for a raw
+  sample with time. Records are kept in a byte ring, the oldest ones
+  are dropped to make space and folded into the base sample the
+  oldest kept record is relative to, so every kept record can be
+  decoded.
+
+  Time stamps are counter values of a td_timer, the time between
+  samples must be shorter than the timer period, so the timer is
+  normally a slow one like a seconds counter. Recording is not
+  reentrant, samples must come from one context and readers must not
+  run while a sample is recorded.
+*/
+
+#ifndef SAMPLE_HISTORY_H_
+#define SAMPLE_HISTORY_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+
+#include "timer_delay.h"
+
+#ifndef SH_BUFFER_LENGTH
+#define SH_BUFFER_LENGTH (256) /* bytes, must be a power of 2 */
+#endif
+
+//! Decoded sample.
+struct sh_sample {
+  uint32_t time; /* timer ticks, unwrapped */
+  int16_t value; /* 1/16 C */
+};
+
+struct sh_buffer {
+  struct td_timer *timer;
+  TD_TIMER_TYPE last_stamp; /* counter value of the newest sample */
+  struct sh_sample newest;
+  struct sh_sample base; /* the oldest record is relative to it */
+  uint_fast16_t head;
+  uint_fast16_t used; /* bytes */
+  uint_fast16_t count; /* samples */
+  uint8_t data[SH_BUFFER_LENGTH];
+};
+
+//! Streaming decoder, walks samples from the oldest one.
+/*! Reader is invalidated by recording into its buffer.
+ */
+struct sh_reader {
+  const struct sh_buffer *buffer;
+  uint_fast16_t position;
+  uint_fast16_t left; /* samples */
+  struct sh_sample sample;
+};
+
+//! Prepare empty buffer, time stamps are taken from the timer.
+int sh_init(struct sh_buffer *buffer, struct td_timer *timer);
+//! Drop all samples.
+int sh_clear(struct sh_buffer *buffer);
+//! Store value with current time.
+int sh_record(struct sh_buffer *buffer, int16_t value);
+//! Store temperature of a scratchpad read with ow_device_read_scratchpad.
+int sh_record_scratchpad(struct sh_buffer *buffer, const uint8_t *scratchpad);
+//! Get number of stored samples.
+uint_fast16_t sh_get_count(const struct sh_buffer *buffer);
+//! Get number of bytes taken by stored samples.
+uint_fast16_t sh_get_used(const struct sh_buffer *buffer);
+
+//! Start decoding samples of the buffer.
+int sh_reader_init(struct sh_reader *reader, const struct sh_buffer *buffer);
+//! Decode next sample, -1 is returned after the newest one.
+int sh_reader_next(struct sh_reader *reader, struct sh_sample *sample);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+#endif  // SAMPLE_HISTORY_H_
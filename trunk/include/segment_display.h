@@ -39,8 +39,17 @@ extern "C" {
 #endif
 
 #include "segment_display_config.h"
+#ifdef SD_ENABLE_TRACE
+#include "pin_trace.h"
+#endif
+#if defined(SD_ENABLE_BRIGHTNESS) || defined(SD_ENABLE_SCHEDULER)
+#include "timer_delay.h"
+#endif
 
 #define SD_SEGMENTS_PER_DIGIT (8)
+#ifndef SD_MAX_DIGITS
+#define SD_MAX_DIGITS (8)
+#endif
 
 //! Convenience structure for mapping segments to pins.
 struct sd_segment {
@@ -64,12 +73,18 @@ enum sd_character {
 
 //! Stores segment display information.
 /*! Contains mapping between segments and pins as well as display
-  state information and function pointers.
+  state information and function pointers. Displays and schedulers
+  are not locked: each is used by one writer thread and one refresh
+  thread (scheduler refreshes from its timer thread only). With
+  SD_THREAD_SAFE reference counts are atomic, so references may be
+  taken and dropped from any thread.
  */
 struct sd_display;
 //! Create new structure that maps pins to segments.
 /*! After creation the structure must be initialized with pin
-  mappings and hardware access functions.
+  mappings and hardware access functions. With SD_DISPLAY_POOL_SIZE
+  displays are taken from a static pool of that size, creation and
+  destruction must then be done from one context.
  */
 int sd_new(struct sd_display **display);
 //! Get reference already created display structure.
@@ -89,6 +104,13 @@ void sd_init_plug(sd_port_t port, sd_pin_t pin, sd_pin_config_t cfg);
 //! Plug function that can be used instead of working pin access function.
 void sd_onoff_plug(sd_port_t port, sd_pin_t pin);
 //! Set functions that init and toggle digit pins.
+/*! With SD_STATIC_PINS pins are accessed through SD_INIT_DIGIT,
+  SD_TURN_ON_DIGIT, SD_TURN_OFF_DIGIT, SD_INIT_SEGMENT,
+  SD_TURN_ON_SEGMENT and SD_TURN_OFF_SEGMENT macros of
+  segment_display_config.h, which get the same arguments as the
+  functions. Function pointers are then not stored and these
+  functions only check their arguments.
+ */
 int sd_set_digit_functions(
     struct sd_display *display,
     void (*init_digit)(sd_port_t, sd_pin_t, sd_pin_config_t),
@@ -100,7 +122,71 @@ int sd_set_segment_functions(
     void (*init_segment)(sd_port_t, sd_pin_t, sd_pin_config_t),
     void (*turn_on_segment)(sd_port_t, sd_pin_t),
     void (*turn_off_segment)(sd_port_t, sd_pin_t));
+//! Port mask and shift register flags.
+enum sd_port_flags {
+  SD_SEGMENTS_ACTIVE_LOW = 0x1,
+  SD_DIGITS_ACTIVE_LOW = 0x2,
+  //! write only segments that differ from shown ones, the first
+  //! refresh after a map or mode change writes all of them
+  SD_PORT_DIFF = 0x4,
+  SD_SHIFT_DIGITS_FIRST = 0x8 //!< send digit bytes before segment byte
+};
+#ifdef SD_ENABLE_PORT_MASKS
+#ifndef SD_MAX_SEGMENT_PORTS
+#define SD_MAX_SEGMENT_PORTS (2)
+#endif
+//! Set function that writes several pins of one port at once.
+/*! When set, sd_show_next does whole port writes instead of per pin
+  calls: previous digit off, one write per segment port, next digit
+  on (merged with segment write if it is on the same port). Pins must
+  be port bit masks, segment pins may use up to SD_MAX_SEGMENT_PORTS
+  ports. Masks for every character are computed here and, while a
+  function is set, in sd_set_segment_map. Pass NULL to return to per
+  pin functions, segment pins may then use any number of ports. When
+  segment pins need more ports the function is dropped and -1 is
+  returned.
+ */
+int sd_set_port_function(
+    struct sd_display *display,
+    void (*write_port)(sd_port_t port, sd_port_mask_t set,
+                       sd_port_mask_t reset),
+    uint_fast8_t flags);
+#endif
+#ifdef SD_ENABLE_SHIFT_REGISTER
+#ifndef SD_SHIFT_DIGIT_BYTES
+#define SD_SHIFT_DIGIT_BYTES (1)
+#endif
+//! Indexes of pins passed to sd_set_shift_pins.
+enum sd_shift_pins {
+  SD_SHIFT_DATA = 0, SD_SHIFT_CLOCK, SD_SHIFT_LATCH, SD_SHIFT_PIN_COUNT
+};
+//! Drive display through chained shift registers like 74HC595.
+/*! Every refresh step is one burst: segment byte and
+  SD_SHIFT_DIGIT_BYTES digit bytes, each byte MSB first. shift_out
+  must send the bytes and pulse the latch, e.g. with SPI. Pins of the
+  segment and digit maps are shift register output numbers: 0-7 for
+  segments, for digits bit number of the digit bytes read as a big
+  endian number. Latch switches all outputs at once, so segments are
+  not blanked between digits. Pin and port functions are not used,
+  pass NULL to return to them.
+ */
+int sd_set_shift_function(
+    struct sd_display *display,
+    void (*shift_out)(const uint8_t *data, uint_fast8_t length),
+    uint_fast8_t flags);
+//! Bit bang shift registers when there is no SPI.
+/*! pins holds data, clock and latch pins in enum sd_shift_pins order.
+  They are inited in sd_init and toggled with segment functions.
+ */
+int sd_set_shift_pins(struct sd_display *display,
+                      const struct sd_segment *pins, uint_fast8_t flags);
+#endif
 //! Set mapping between digits and pins.
+/*! Display keeps pin maps and frames inside its structure, so
+  digit_count is at most SD_MAX_DIGITS. Frames are cleared except for
+  the dot and refresh starts again from digit 0, pins of a running
+  display are set up with sd_init after the new map.
+ */
 int sd_set_digit_map(struct sd_display *display, int_fast8_t digit_count,
                      const struct sd_segment *digit_map);
 //! Set mapping between segments and pins.
@@ -108,23 +194,174 @@ int sd_set_segment_map(struct sd_display *display,
                        const struct sd_segment *segment_map);
 //! Init all display pins.
 int sd_init(struct sd_display *display);
-//! Set display data.
+//! Show characters, data must contain one character per digit.
+/*! Data is copied into the display and published, later changes of
+  data are not shown until this function is called again.
+ */
 int sd_connect_display_to_data(struct sd_display *display, enum sd_character *data);
+//! Set character of one digit, shown after sd_publish.
+/*! Display keeps two frames of segment patterns (bit n is segment n,
+  see char_segment_patterns). Setters and number functions write the
+  back frame while sd_show_next reads the front one. sd_publish swaps
+  them with a single store, so refresh interrupt never sees half
+  updated data and is never blocked. Refresh and writers must run on
+  one core unless SD_THREAD_SAFE is defined, then front frame is
+  published with a release store read by an acquire load and refresh
+  may run on another thread. Setters of a display are used from one thread at a time.
+ */
+int sd_set_character(struct sd_display *display, int_fast8_t digit,
+                     enum sd_character ch);
+//! Set raw segment pattern of one digit, shown after sd_publish.
+int sd_set_segments(struct sd_display *display, int_fast8_t digit,
+                    uint8_t pattern);
+//! Make back frame visible, new back frame starts as its copy.
+int sd_publish(struct sd_display *display);
 //! Set dot position.
-/*! Pass -1 to erase dot.
+/*! Pass -1 to erase dot. Dot is part of the back frame, it is shown
+  after sd_publish.
  */
 int sd_set_dot_position(struct sd_display *display, int_fast8_t pos);
 //! Get dot position.
 /* Return -1 if dot is not shown.
  */
 int_fast8_t sd_get_dot_position(struct sd_display *display);
+//! Get digit (segment line in segment scan) lit by the refresh.
+/*! moves, if not NULL, is set to 1 when the next sd_show_next goes to
+  the next digit and to 0 when it continues brightness slices of this
+  one. A frame ends when the scan moves to position 0.
+ */
+int_fast8_t sd_get_scan_position(struct sd_display *display,
+                                 uint_fast8_t *moves);
+#ifdef SD_ENABLE_TRACE
+//! Record pin changes made by sd_show_next.
+/*! Digit i is recorded as signal first_signal + i, segment s as
+  first_signal + digit_count + s. Pass NULL trace to stop recording.
+ */
+int sd_set_trace(struct sd_display *display, struct pt_buffer *trace,
+                 uint_fast8_t first_signal);
+#endif
 //! Light up next digit.
+/*! With SD_ENABLE_BRIGHTNESS a digit takes several calls, see
+  sd_get_next_delay.
+ */
 int sd_show_next(struct sd_display *display);
+#ifdef SD_ENABLE_SEGMENT_SCAN
+#define SD_SCAN_MAX_DIGITS (16)
+//! Refresh scan modes.
+enum sd_scan_modes {
+  SD_SCAN_DIGITS = 0, //!< one digit per step
+  SD_SCAN_SEGMENTS    //!< one segment line of all digits per step
+};
+//! Select what sd_show_next lights in one step.
+/*! In segment scan a frame takes SD_SEGMENTS_PER_DIGIT steps whatever
+  the digit count, so each segment is lit 1/8 of time instead of
+  1/digit_count. Each step turns on digit pins whose digit has the
+  segment, so digit drivers carry one segment current and segment
+  drivers the current of all digits. Digits are read from a transposed
+  frame made by sd_publish. Works with pin functions and shift
+  registers, brightness is global only. At most SD_SCAN_MAX_DIGITS
+  digits.
+ */
+int sd_set_scan_mode(struct sd_display *display, uint_fast8_t mode);
+#endif
+#ifdef SD_ENABLE_BRIGHTNESS
+#ifndef SD_BRIGHTNESS_BITS
+#define SD_BRIGHTNESS_BITS (3)
+#endif
+#define SD_BRIGHTNESS_MAX ((1 << SD_BRIGHTNESS_BITS) - 1)
+//! Set brightness of a digit, pass -1 as digit for global brightness.
+/*! Levels go from 0 (off) to SD_BRIGHTNESS_MAX, digit level is scaled
+  by global one. Brightness is made by binary code modulation: digit
+  time is split into slices of unit*2^n ticks, n-th slice is lit if
+  n-th bit of level is set. Adjacent slices with equal bits are
+  merged, so full brightness needs one sd_show_next call per digit
+  and dimming adds at most SD_BRIGHTNESS_BITS-1 calls. Digit of level
+  0 is never turned on. Must be called after sd_set_digit_map.
+ */
+int sd_set_brightness(struct sd_display *display, int_fast8_t digit,
+                      uint_fast8_t level);
+//! Set length of the shortest slice in timer ticks.
+int sd_set_brightness_unit(struct sd_display *display, TD_TIMER_TYPE unit);
+//! Get timer ticks till next sd_show_next call.
+TD_TIMER_TYPE sd_get_next_delay(struct sd_display *display);
+#endif
+#ifdef SD_ENABLE_SCHEDULER
+#ifndef SD_SCHEDULER_DISPLAYS
+#define SD_SCHEDULER_DISPLAYS (4)
+#endif
+//! Refreshes several displays from one timer interrupt.
+/*! Frame is split into slots, one per digit of the longest display
+  (8 for segment scan). Every display shows one digit per slot and is
+  dark in the remaining slots of the frame, so digits of all displays
+  get equal on-time and frame rate. Slot starts of different displays
+  are spread over the slot to spread interrupt work and current
+  peaks. With SD_ENABLE_BRIGHTNESS brightness unit of displays is set
+  to fit digit slices into a slot.
+ */
+struct sd_scheduler;
+int sd_scheduler_new(struct sd_scheduler **scheduler);
+struct sd_scheduler *sd_scheduler_ref(struct sd_scheduler *scheduler);
+struct sd_scheduler *sd_scheduler_unref(struct sd_scheduler *scheduler);
+void sd_scheduler_free(struct sd_scheduler *scheduler);
+//! Add configured display, at most SD_SCHEDULER_DISPLAYS.
+/*! Display is referenced by scheduler. Adding restarts all frames.
+ */
+int sd_scheduler_add(struct sd_scheduler *scheduler,
+                     struct sd_display *display);
+//! Set digit slot length in timer ticks.
+int sd_scheduler_set_slot(struct sd_scheduler *scheduler, TD_TIMER_TYPE slot);
+//! Set free running counter used to measure time spent in service.
+int sd_scheduler_set_clock(struct sd_scheduler *scheduler,
+                           TD_TIMER_TYPE (*get_counter)(void),
+                           TD_TIMER_TYPE period);
+//! Refresh displays that are due, call from timer interrupt.
+/*! Return ticks till the next call, timer must fire exactly then as
+  scheduler counts time by returned values.
+ */
+TD_TIMER_TYPE sd_scheduler_service(struct sd_scheduler *scheduler);
+//! Get frame length in timer ticks.
+TD_TIMER_TYPE sd_scheduler_get_frame_length(struct sd_scheduler *scheduler);
+//! Get clock ticks spent in sd_scheduler_service during last frame.
+/*! Divide by frame length to get CPU load of refresh, both use the
+  same units if the clock is the refresh timer counter.
+ */
+TD_TIMER_TYPE sd_scheduler_get_frame_cost(struct sd_scheduler *scheduler);
+#endif
+//! Number format flags.
+enum sd_format_flags {
+  SD_BLANK_ZEROS = 0x1 //!< leading zeros are not shown
+};
 //! Display an unsigned int at given location
+/*! Digits from first_digit (least significant) to last_digit are
+  filled, higher digits of the value are dropped. Numbers are
+  converted without division.
+ */
 int sd_display_uint(struct sd_display *display, int_fast8_t first_digit,
 		    int_fast8_t last_digit, unsigned value);
+//! Display an unsigned int, SD_BLANK_ZEROS flag is accepted.
+int sd_display_uint_ex(struct sd_display *display, int_fast8_t first_digit,
+                       int_fast8_t last_digit, unsigned value,
+                       uint_fast8_t flags);
+//! Display an int, last digit shows the sign.
 int sd_display_int(struct sd_display *display, int_fast8_t first_digit,
 		   int_fast8_t last_digit, int value);
+//! Display an int, SD_BLANK_ZEROS moves the sign next to the number.
+int sd_display_int_ex(struct sd_display *display, int_fast8_t first_digit,
+                      int_fast8_t last_digit, int value,
+                      uint_fast8_t flags);
+//! Display an unsigned int in hex, SD_BLANK_ZEROS flag is accepted.
+int sd_display_hex(struct sd_display *display, int_fast8_t first_digit,
+                   int_fast8_t last_digit, unsigned value,
+                   uint_fast8_t flags);
+//! Display value/10^frac_digits and put dot after the integer part.
+/*! With SD_BLANK_ZEROS the minus sign is moved next to the number.
+  Without fraction digits a dot inside first_digit..last_digit is
+  removed and a dot elsewhere is kept. Returns -1 if frac_digits
+  leave no digit for the integer part.
+ */
+int sd_display_fixed(struct sd_display *display, int_fast8_t first_digit,
+                     int_fast8_t last_digit, int value,
+                     uint_fast8_t frac_digits, uint_fast8_t flags);
 
 
 #ifdef __cplusplus
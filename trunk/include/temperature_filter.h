@@ -0,0 +1,101 @@
+/* temperature_filter.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file temperature_filter.h
+  Incremental filtering of raw DS18B20 temperatures of many sensors.
+
+  Every update takes one value per sensor, in 1/16 C like bytes 0-1
+  of the scratchpad, and passes it through three stages:
+  - rejection: a value jumping more than max_step from the last
+    accepted one is replaced by the last accepted one. After
+    TF_REJECT_LIMIT rejections in a row the jump is taken as real,
+    except for the 85 C power-on value which is accepted only when it
+    is within max_step, so it is always rejected before the first
+    accepted sample. TF_NO_VALUE is replaced the same way, but does
+    not count as a rejection;
+  - median of the last TF_MEDIAN_LENGTH accepted values (1, 3 or 5);
+  - moving average of the last TF_AVERAGE_LENGTH medians.
+
+  State is kept as a structure of arrays with one element per sensor,
+  all sensors are updated together by two loops without calls or
+  branches, which compilers vectorize on a host. The first
+  accepted value of a sensor fills its windows, until then its output
+  is TF_NO_VALUE.
+*/
+
+#ifndef TEMPERATURE_FILTER_H_
+#define TEMPERATURE_FILTER_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+
+#ifndef TF_MAX_SENSORS
+#define TF_MAX_SENSORS (8)
+#endif
+#ifndef TF_MEDIAN_LENGTH
+#define TF_MEDIAN_LENGTH (3) /* 1, 3 or 5 */
+#endif
+#ifndef TF_AVERAGE_LENGTH
+#define TF_AVERAGE_LENGTH (4) /* must be a power of 2 */
+#endif
+#ifndef TF_REJECT_LIMIT
+#define TF_REJECT_LIMIT (3)
+#endif
+
+//! Missing value.
+/*! Passed for failed readings, returned before the first accepted
+  value.
+ */
+#define TF_NO_VALUE (-32767 - 1)
+//! 85 C, temperature register value after sensor power-on.
+#define TF_POWER_ON_VALUE (0x0550)
+
+struct tf_bank {
+  uint_fast8_t sensor_count;
+  uint_fast8_t unprimed; /* sensors without accepted value */
+  uint_fast8_t median_slot;
+  uint_fast8_t average_slot;
+  int16_t max_step;
+  int16_t last[TF_MAX_SENSORS]; /* last accepted value */
+  uint8_t rejected[TF_MAX_SENSORS]; /* rejections in a row */
+  uint8_t primed[TF_MAX_SENSORS];
+  int16_t median[TF_MEDIAN_LENGTH][TF_MAX_SENSORS];
+  int16_t average[TF_AVERAGE_LENGTH][TF_MAX_SENSORS];
+  int32_t sum[TF_MAX_SENSORS];
+  int16_t output[TF_MAX_SENSORS];
+};
+
+//! Prepare bank for sensor_count sensors.
+/*! max_step is the largest accepted change between two updates in
+  1/16 C.
+ */
+int tf_init(struct tf_bank *bank, uint_fast8_t sensor_count,
+	    int16_t max_step);
+//! Forget history of one sensor, e.g. after it was replaced.
+int tf_reset_sensor(struct tf_bank *bank, uint_fast8_t sensor);
+//! Feed one value per sensor, TF_NO_VALUE for failed readings.
+int tf_update(struct tf_bank *bank, const int16_t *values);
+//! Get filtered values of all sensors.
+const int16_t *tf_get_output(const struct tf_bank *bank);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+#endif  // TEMPERATURE_FILTER_H_
@@ -0,0 +1,127 @@
+/* virtual_display.h
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file virtual_display.h
+  Virtual LED matrix for segment_display, built for host only.
+
+  vd_init_pin, vd_digit_on and other pin functions are passed to
+  sd_set_digit_functions and sd_set_segment_functions (or called from
+  SD_TURN_ON_DIGIT and other macros with SD_STATIC_PINS). They switch
+  LEDs of the attached virtual display, a LED is lit while both its
+  digit and its segment are on. Time is virtual: it moves by
+  vd_advance and by callback_cost ticks per pin call.
+
+  Refresh steps are marked with vd_begin_step and vd_end_step, or
+  done with vd_show_next. A LED lit inside a step while it is dark
+  both before and after the step is a ghost, e.g. previous digit
+  showing segments of the next one. Lit periods are counted at step
+  ends. Frames are counted by vd_show_next from the scan position of
+  the refreshed display, they give the effective refresh rate.
+*/
+
+#ifndef VIRTUAL_DISPLAY_H_
+#define VIRTUAL_DISPLAY_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "segment_display.h"
+
+//! Counters of one LED.
+struct vd_led {
+  uint32_t on_time; // ticks lit
+  uint32_t lit_periods; // dark to lit changes between steps
+  uint32_t ghosts; // steps in which LED flashed as ghost
+  uint32_t ghost_time; // ticks lit as ghost
+};
+
+struct vd_display {
+  uint32_t ticks_per_second;
+  uint32_t callback_cost;
+  int_fast8_t digit_count;
+  struct sd_segment digit_map[SD_MAX_DIGITS];
+  struct sd_segment segment_map[SD_SEGMENTS_PER_DIGIT];
+  uint8_t digit_on[SD_MAX_DIGITS];
+  uint8_t segments_on; // bit n is segment n
+  int in_step;
+  uint8_t step_start[SD_MAX_DIGITS]; // lit segments per digit
+  uint8_t step_seen[SD_MAX_DIGITS];
+  uint32_t step_time[SD_MAX_DIGITS][SD_SEGMENTS_PER_DIGIT];
+  uint32_t time;
+  uint32_t callbacks;
+  uint32_t steps;
+  uint32_t frames; // scans wrapped to the first digit
+  struct vd_led leds[SD_MAX_DIGITS][SD_SEGMENTS_PER_DIGIT];
+};
+
+//! Summary of recorded refresh.
+struct vd_metrics {
+  uint32_t time;
+  uint32_t frames; // refresh scans wrapped to the first digit
+  uint32_t callbacks;
+  uint32_t ghosts;
+  uint32_t ghost_time;
+  double refresh_rate; // frames per second
+  double callbacks_per_frame;
+};
+
+//! Prepare dark display with the same pin maps as the real one.
+/*! Pins are matched by port and pin, calls for other pins are only
+  counted. ticks_per_second converts virtual time for refresh rate.
+ */
+int vd_init(struct vd_display *display, int_fast8_t digit_count,
+            const struct sd_segment *digit_map,
+            const struct sd_segment *segment_map,
+            uint32_t ticks_per_second);
+//! Set virtual time taken by every pin call, 0 by default.
+int vd_set_callback_cost(struct vd_display *display, uint32_t ticks);
+//! Make display the target of pin functions.
+int vd_attach(struct vd_display *display);
+//! Clear counters, LED states are kept.
+int vd_reset_metrics(struct vd_display *display);
+
+//! Pin functions for sd_set_digit_functions.
+void vd_init_pin(sd_port_t port, sd_pin_t pin, sd_pin_config_t cfg);
+void vd_digit_on(sd_port_t port, sd_pin_t pin);
+void vd_digit_off(sd_port_t port, sd_pin_t pin);
+//! Pin functions for sd_set_segment_functions.
+void vd_segment_on(sd_port_t port, sd_pin_t pin);
+void vd_segment_off(sd_port_t port, sd_pin_t pin);
+
+//! Move virtual time, lit LEDs collect on-time.
+void vd_advance(struct vd_display *display, uint32_t ticks);
+int vd_begin_step(struct vd_display *display);
+int vd_end_step(struct vd_display *display);
+//! Run one sd_show_next as a step and let ticks pass after it.
+int vd_show_next(struct vd_display *display, struct sd_display *source,
+                 uint32_t ticks);
+
+//! Get counters of one LED.
+const struct vd_led *vd_get_led(const struct vd_display *display,
+                                int_fast8_t digit, uint_fast8_t segment);
+int vd_get_metrics(const struct vd_display *display,
+                   struct vd_metrics *metrics);
+//! Print summary and per LED duty in per mille.
+int vd_write_report(FILE *out, const struct vd_display *display);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+#endif  // VIRTUAL_DISPLAY_H_
@@ -1,9 +1,51 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "one_wire.h"
+#include "object_pool.h"
 
 #define ARRAY_SIZE(x) sizeof(x)/sizeof(x[0])
 
+#ifdef OW_ENABLE_STATS
+/* busy is counted by devices failing to claim a shared bus, so
+   counters are atomic in thread safe mode */
+#ifdef OW_THREAD_SAFE
+#define OW_STATS_INC(obj, counter)					\
+  __atomic_add_fetch(&((obj)->stats.counter), 1, __ATOMIC_RELAXED)
+#else
+#define OW_STATS_INC(obj, counter) ((obj)->stats.counter++)
+#endif
+#define OW_STATS_OVERSHOOT(bus, ticks)	\
+  ow_stats_hit((bus)->stats.overshoot, (ticks))
+#else
+#define OW_STATS_INC(obj, counter)
+#define OW_STATS_OVERSHOOT(bus, ticks) ((void)(ticks))
+#endif
+
+/* Reference counts and bus owner are atomic in thread safe mode. */
+#ifdef OW_THREAD_SAFE
+#if defined(OW_BUS_POOL_SIZE) || defined(OW_DEVICE_POOL_SIZE) \
+  || defined(OW_ENGINE_POOL_SIZE)
+#error "static pools are not thread safe"
+#endif
+#define OW_REF_INC(count) __atomic_add_fetch(&(count), 1, __ATOMIC_RELAXED)
+#define OW_REF_DEC(count) __atomic_sub_fetch(&(count), 1, __ATOMIC_ACQ_REL)
+#else
+#define OW_REF_INC(count) (++(count))
+#define OW_REF_DEC(count) (--(count))
+#endif
+
+#ifdef OW_ENABLE_TRACE
+#define OW_TRACE(bus, offset, value)					\
+  do {									\
+    if ((bus)->trace) {							\
+      pt_record((bus)->trace, (bus)->trace_signal + (offset), (value));	\
+    }									\
+  } while (0)
+#else
+#define OW_TRACE(bus, offset, value) do { (void)(bus); } while (0)
+#endif
+
 uint8_t ow_crc(uint8_t *data, int length) {
   int bi, di;
   uint8_t crc = 0;
@@ -35,20 +77,48 @@ int_fast8_t ow_calculate_temperature(uint8_t lsb, uint8_t msb,
   return 0;
 }
 
-enum ow_errors {
-  OW_ERROR = 1,
-  OW_ERROR_BUSY,
-  OW_ERROR_NOOP,
-  OW_ERROR_NO_RESPONSE,
-  OW_ERROR_BUS_DOWN
-};
+#ifdef OW_ENABLE_STATS
+/* Bin 0 counts zeros, bin n counts values from 2^(n-1) to 2^n - 1,
+   the last bin also takes everything above. */
+static void ow_stats_hit(uint16_t *histogram, int32_t value) {
+  uint_fast8_t bin = 0;
+  while (value > 0 && bin < OW_STATS_BINS - 1) {
+    value >>= 1;
+    bin++;
+  }
+  histogram[bin]++;
+}
+
+static void ow_stats_count_error(struct ow_stats *stats, int_fast8_t rc) {
+  switch (rc) {
+  case -OW_ERROR_NO_RESPONSE:
+    stats->no_response++;
+    break;
+  case -OW_ERROR_BUS_DOWN:
+    stats->bus_down++;
+    break;
+  case -OW_ERROR_CRC:
+    stats->crc_errors++;
+    break;
+  case -OW_ERROR_BUSY:
+    stats->busy++;
+    break;
+  }
+}
+
+void ow_stats_clear(struct ow_stats *stats) {
+  memset(stats, 0, sizeof(struct ow_stats));
+}
+#endif
 
 enum ow_bus_states {
   OW_BUS_IDLE,
   OW_BUS_RESET_PULSE,
   OW_BUS_RESET_RECOVER,
   OW_BUS_WRITE,
-  OW_BUS_READ
+  OW_BUS_READ,
+  OW_BUS_DELAY,
+  OW_BUS_RECOVER
 };
 
 struct ow_bus {
@@ -58,15 +128,68 @@ struct ow_bus {
   uint_fast8_t data;
   uint_fast8_t *out_data;
   uint_fast8_t bit;
+  TD_TIMER_TYPE deadline; /* ticks from td_start till next step */
+  struct ow_device *owner; /* device running transaction */
+#ifdef OW_ENABLE_STATS
+  struct ow_stats stats;
+  uint32_t time; /* ticks accumulated by previous timer restarts */
+#endif
+#ifdef OW_ENABLE_TRACE
+  struct pt_buffer *trace;
+  uint_fast8_t trace_signal;
+#endif
+#ifndef OW_STATIC_PINS
   void (*output_fn)(void);
   void (*input_fn)(void);
   void (*pull_up_fn)(void);
   void (*pull_down_fn)(void);
   uint_fast8_t (*read_fn)(void);
+#endif
 };
+/* Pin access, with OW_STATIC_PINS config macros are expanded instead
+   of calling stored functions. */
+#ifdef OW_STATIC_PINS
+#define OW_PIN(bus, fn, macro) macro()
+#else
+#define OW_PIN(bus, fn, macro) (bus)->fn()
+#endif
+/* Traced line level assumes released bus is pulled up. */
+static void ow_bus_drive(struct ow_bus *bus) {
+#ifdef OW_STATIC_PINS
+  (void)bus;
+#endif
+  OW_PIN(bus, output_fn, OW_PIN_OUTPUT);
+}
+static void ow_bus_listen(struct ow_bus *bus) {
+  OW_PIN(bus, input_fn, OW_PIN_INPUT);
+  OW_TRACE(bus, 0, 1);
+}
+static void ow_bus_pull_up(struct ow_bus *bus) {
+  OW_PIN(bus, pull_up_fn, OW_PIN_PULL_UP);
+  OW_TRACE(bus, 0, 1);
+}
+static void ow_bus_pull_down(struct ow_bus *bus) {
+  OW_PIN(bus, pull_down_fn, OW_PIN_PULL_DOWN);
+  OW_TRACE(bus, 0, 0);
+}
+static uint_fast8_t ow_bus_sample(struct ow_bus *bus) {
+  uint_fast8_t value = OW_PIN(bus, read_fn, OW_PIN_READ);
+  OW_TRACE(bus, 1, PT_STROBE | (value ? 1 : 0));
+  return value;
+}
+#ifdef OW_BUS_POOL_SIZE
+/* With OW_*_POOL_SIZE objects come from static pools, see
+   object_pool.h. */
+OBJECT_POOL(ow_bus, struct ow_bus, OW_BUS_POOL_SIZE)
+#endif
 /* Create and destruction. */
 int_fast8_t ow_bus_new(struct ow_bus **bus) {
-  struct ow_bus *new_bus = calloc(1, sizeof(struct ow_bus));
+  struct ow_bus *new_bus;
+#ifdef OW_BUS_POOL_SIZE
+  new_bus = ow_bus_pool_take();
+#else
+  new_bus = calloc(1, sizeof(struct ow_bus));
+#endif
   if (!new_bus) return -OW_ERROR;
   new_bus->refcount = 1;
   new_bus->state = OW_BUS_IDLE;
@@ -75,19 +198,22 @@ int_fast8_t ow_bus_new(struct ow_bus **bus) {
 }
 struct ow_bus *ow_bus_ref(struct ow_bus *bus) {
   if (bus == NULL) return NULL;
-  bus->refcount++;
+  OW_REF_INC(bus->refcount);
   return bus;
 }
 struct ow_bus *ow_bus_unref(struct ow_bus *bus) {
   if (bus == NULL) return NULL;
-  bus->refcount--;
-  if (bus->refcount > 0) return bus;
+  if (OW_REF_DEC(bus->refcount) > 0) return bus;
   ow_bus_free(bus);
   return NULL;
 }
 void ow_bus_free(struct ow_bus *bus) {
   if (bus == NULL) return;
+#ifdef OW_BUS_POOL_SIZE
+  ow_bus_pool_give(bus);
+#else
   free(bus);
+#endif
 }
 /* Init functions. */
 int_fast8_t ow_bus_set_timer(struct ow_bus *bus, struct td_timer *timer) {
@@ -97,49 +223,112 @@ int_fast8_t ow_bus_set_timer(struct ow_bus *bus, struct td_timer *timer) {
 }
 int_fast8_t ow_bus_set_output_fn(struct ow_bus *bus, void (*output_fn)(void)) {
   if (bus == NULL || output_fn == NULL) return -OW_ERROR;
+#ifndef OW_STATIC_PINS
   bus->output_fn = output_fn;
+#endif
   return 0;
 }
 int_fast8_t ow_bus_set_input_fn(struct ow_bus *bus, void (*input_fn)(void)) {
   if (bus == NULL || input_fn == NULL) return -OW_ERROR;
+#ifndef OW_STATIC_PINS
   bus->input_fn = input_fn;
+#endif
   return 0;
 }
 int_fast8_t ow_bus_set_pull_up_fn(struct ow_bus *bus, void (*pull_up_fn)(void)) {
   if (bus == NULL || pull_up_fn == NULL) return -OW_ERROR;
+#ifndef OW_STATIC_PINS
   bus->pull_up_fn = pull_up_fn;
+#endif
   return 0;
 }
 int_fast8_t ow_bus_set_pull_down_fn(struct ow_bus *bus, void (*pull_down_fn)(void)) {
   if (bus == NULL || pull_down_fn == NULL) return -OW_ERROR;
+#ifndef OW_STATIC_PINS
   bus->pull_down_fn = pull_down_fn;
+#endif
   return 0;
 }
 int_fast8_t ow_bus_set_read_fn(struct ow_bus *bus, uint_fast8_t (*read_fn)(void)) {
   if (bus == NULL || read_fn == NULL) return -OW_ERROR;
+#ifndef OW_STATIC_PINS
   bus->read_fn = read_fn;
+#endif
+  return 0;
+}
+#ifdef OW_ENABLE_TRACE
+int_fast8_t ow_bus_set_trace(struct ow_bus *bus, struct pt_buffer *trace,
+			     uint_fast8_t first_signal) {
+  if (bus == NULL) return -OW_ERROR;
+  bus->trace = trace;
+  bus->trace_signal = first_signal;
   return 0;
 }
+#endif
+#ifdef OW_ENABLE_STATS
+const struct ow_stats *ow_bus_get_stats(struct ow_bus *bus) {
+  if (bus == NULL) return NULL;
+  return &(bus->stats);
+}
+/* Running time used to measure transactions longer than timer period. */
+static uint32_t ow_bus_get_time(struct ow_bus *bus) {
+  return bus->time + td_get_elapsed(bus->timer);
+}
+#endif
 /* interface helper functions */
+static void ow_bus_start_timer(struct ow_bus *bus) {
+#ifdef OW_ENABLE_STATS
+  bus->time += td_get_elapsed(bus->timer);
+#endif
+  td_start(bus->timer);
+}
+/* Schedule next step of the current operation, deadline is counted
+   from the last td_start call. */
+static int_fast8_t ow_bus_defer(struct ow_bus *bus, TD_TIMER_TYPE deadline) {
+  bus->deadline = deadline;
+  return 1;
+}
+TD_TIMER_TYPE ow_bus_get_wait(struct ow_bus *bus) {
+  TD_TIMER_TYPE elapsed = td_get_elapsed(bus->timer);
+  if (elapsed >= bus->deadline) return 0;
+  return bus->deadline - elapsed;
+}
 int_fast8_t ow_bus_continue(struct ow_bus *bus) {
-  int_fast8_t rc;
+  TD_TIMER_TYPE elapsed;
+  if (bus->state != OW_BUS_IDLE) {
+    elapsed = td_get_elapsed(bus->timer);
+    if (elapsed < bus->deadline) {
+      return 1;
+    }
+    OW_STATS_OVERSHOOT(bus, elapsed - bus->deadline);
+  }
   switch (bus->state) {
   case OW_BUS_IDLE:
     return -OW_ERROR_NOOP;
   case OW_BUS_RESET_PULSE:
-    rc = ow_bus_check_reset_response(bus);
-    if (rc < 0) bus->state = OW_BUS_IDLE;
-    return rc;
+    /* release the bus and wait for the answer in the same call */
+    ow_bus_pull_up(bus);
+    ow_bus_listen(bus);
+    ow_bus_start_timer(bus);
+    return ow_bus_check_reset_response(bus);
   case OW_BUS_RESET_RECOVER:
-    if (!td_has_elapsed(bus->timer, 500)) {
-      return 1;
-    }
     bus->state = OW_BUS_IDLE;
+    if (ow_bus_sample(bus) == 0) { /* the bus was not released */
+      ow_bus_drive(bus);
+      OW_STATS_INC(bus, bus_down);
+      return -OW_ERROR_BUS_DOWN;
+    }
+    ow_bus_drive(bus);
     return 0;
   case OW_BUS_WRITE:
     return ow_bus_write_next_bit(bus);
   case OW_BUS_READ:
     return ow_bus_read_next_bit(bus);
+  case OW_BUS_DELAY:
+    bus->state = OW_BUS_IDLE;
+    return 0;
+  case OW_BUS_RECOVER:
+    return ow_bus_recover_next_slot(bus);
   default:
     return -OW_ERROR;
   }
@@ -151,47 +340,42 @@ int_fast8_t ow_bus_terminate_operation(struct ow_bus *bus) {
 /* Interface functions. */
 int_fast8_t ow_bus_reset(struct ow_bus *bus) {
   if (bus->state != OW_BUS_IDLE) {
+    OW_STATS_INC(bus, busy);
     return -OW_ERROR_BUSY;
   }
   /* pull down bus and wait for 500 us */
-  bus->output_fn();
-  bus->pull_down_fn();
-  td_start(bus->timer);
+  ow_bus_drive(bus);
+  ow_bus_pull_down(bus);
+  ow_bus_start_timer(bus);
+  OW_STATS_INC(bus, resets);
   bus->state = OW_BUS_RESET_PULSE;
-  return 1;
+  return ow_bus_defer(bus, 500);
 }
 
 int_fast8_t ow_bus_check_reset_response(struct ow_bus *bus) {
-  uint16_t capture;
-  if (!td_has_elapsed(bus->timer, 500)) {
-    return 1;
+  uint_fast8_t level;
+  /* presence pulse starts 15-60 usec after release and lasts 60-240
+     usec, the line is sampled from 15 usec till it goes low or 240
+     usec pass, the whole window is inside of this call */
+  OW_STATS_OVERSHOOT(bus, td_wait(bus->timer, 15));
+  level = ow_bus_sample(bus);
+  while (level > 0 && td_get_elapsed(bus->timer) < 240) {
+    level = ow_bus_sample(bus);
   }
-  /* pull up and wait a little, this should not be required */
-  bus->pull_up_fn();
-  td_start(bus->timer);
-  td_wait(bus->timer, 1);
-  /* wait for response pull */
-  bus->input_fn();
-  while (bus->read_fn() > 0
-  	 && (capture = td_get_elapsed(bus->timer)) < 480);
-  if (capture >= 480) { /* the bus was not pulled down */
-    bus->output_fn();
+  if (level > 0) { /* the bus was not pulled down */
+    ow_bus_drive(bus);
+    bus->state = OW_BUS_IDLE;
+    OW_STATS_INC(bus, no_response);
     return -OW_ERROR_NO_RESPONSE;
   }
-  /* wait during down time */
-  td_start(bus->timer); /* wait 480 usec from now to let device recover*/
-  while (bus->read_fn() == 0
-  	 && (capture = td_get_elapsed(bus->timer)) < 480);
-  bus->output_fn();
-  if (capture >= 480) { /* the bus was not released */
-    return -OW_ERROR_BUS_DOWN;
-  }
+  /* wait 480 usec from release to let device recover */
   bus->state = OW_BUS_RESET_RECOVER;
-  return 1;
+  return ow_bus_defer(bus, 480);
 }
 
 int_fast8_t ow_bus_write(struct ow_bus *bus, uint8_t data) {
   if (bus->state != OW_BUS_IDLE) {
+    OW_STATS_INC(bus, busy);
     return -OW_ERROR_BUSY;
   }
   bus->state = OW_BUS_WRITE;
@@ -201,25 +385,28 @@ int_fast8_t ow_bus_write(struct ow_bus *bus, uint8_t data) {
 }
 
 int_fast8_t ow_bus_write_next_bit(struct ow_bus *bus) {
-  bus->output_fn();
-  bus->pull_down_fn();
-  td_start(bus->timer);
-  td_wait(bus->timer, 2);
-  if (bus->data & (1<<(bus->bit))) {
-      bus->pull_up_fn();
-  }
-  td_wait(bus->timer, 90);
-  bus->pull_up_fn();
-  bus->bit++;
   if (bus->bit == 8) {
     bus->state = OW_BUS_IDLE;
     return 0;
   }
-  return 1;
+  ow_bus_drive(bus);
+  ow_bus_pull_down(bus);
+  ow_bus_start_timer(bus);
+  /* low phase ends inside the call, so late calls can not stretch a
+     zero past 120 usec */
+  if (bus->data & (1<<(bus->bit))) {
+    OW_STATS_OVERSHOOT(bus, td_wait(bus->timer, 2));
+  } else {
+    OW_STATS_OVERSHOOT(bus, td_wait(bus->timer, 60));
+  }
+  ow_bus_pull_up(bus);
+  bus->bit++;
+  return ow_bus_defer(bus, 70); /* slot end and recovery */
 }
 
 int_fast8_t ow_bus_read(struct ow_bus *bus, uint8_t *data) {
   if (bus->state != OW_BUS_IDLE) {
+    OW_STATS_INC(bus, busy);
     return -OW_ERROR_BUSY;
   }
   bus->state = OW_BUS_READ;
@@ -231,32 +418,62 @@ int_fast8_t ow_bus_read(struct ow_bus *bus, uint8_t *data) {
 
 int_fast8_t ow_bus_read_bit(struct ow_bus *bus) {
   uint_fast8_t rc;
-  bus->output_fn();
-  bus->pull_down_fn();
-  td_start(bus->timer);
-  td_wait(bus->timer, 1);
-  bus->input_fn();
-  td_wait(bus->timer, 11);
-  rc = bus->read_fn();
+  ow_bus_drive(bus);
+  ow_bus_pull_down(bus);
+  ow_bus_start_timer(bus);
+  OW_STATS_OVERSHOOT(bus, td_wait(bus->timer, 1));
+  ow_bus_listen(bus);
+  OW_STATS_OVERSHOOT(bus, td_wait(bus->timer, 11));
+  rc = ow_bus_sample(bus);
+  bus->deadline = 70;
   return rc;
 }
 
-int_fast8_t ow_bus_read_next_bit(struct ow_bus *bus) {
-  uint_fast8_t rc;
-  bus->output_fn();
-  bus->pull_down_fn();
-  td_start(bus->timer);
-  td_wait(bus->timer, 1);
-  bus->input_fn();
-  td_wait(bus->timer, 11);
-  rc = bus->read_fn();
-  *(bus->out_data) |= (rc<<(bus->bit));
+int_fast8_t ow_bus_delay(struct ow_bus *bus, TD_TIMER_TYPE delay) {
+  if (bus->state != OW_BUS_IDLE) {
+    OW_STATS_INC(bus, busy);
+    return -OW_ERROR_BUSY;
+  }
+  ow_bus_start_timer(bus);
+  bus->state = OW_BUS_DELAY;
+  return ow_bus_defer(bus, delay);
+}
+
+int_fast8_t ow_bus_recover(struct ow_bus *bus) {
+  if (bus->state != OW_BUS_IDLE) {
+    OW_STATS_INC(bus, busy);
+    return -OW_ERROR_BUSY;
+  }
+  bus->state = OW_BUS_RECOVER;
+  bus->bit = 0;
+  return ow_bus_recover_next_slot(bus);
+}
+
+int_fast8_t ow_bus_recover_next_slot(struct ow_bus *bus) {
+  /* read slots clock a device that lost sync through its transfer,
+     the line is free once a slot reads 1 */
+  if (ow_bus_read_bit(bus) > 0) {
+    bus->state = OW_BUS_IDLE;
+    return 0;
+  }
   bus->bit++;
+  if (bus->bit == OW_BUS_RECOVER_SLOTS) {
+    bus->state = OW_BUS_IDLE;
+    OW_STATS_INC(bus, bus_down);
+    return -OW_ERROR_BUS_DOWN;
+  }
+  return ow_bus_defer(bus, 70);
+}
+
+int_fast8_t ow_bus_read_next_bit(struct ow_bus *bus) {
   if (bus->bit == 8) {
     bus->state = OW_BUS_IDLE;
     return 0;
   }
-  return 1;
+  /* the sample must be taken within 15 usec, too short to defer */
+  *(bus->out_data) |= (ow_bus_read_bit(bus)<<(bus->bit));
+  bus->bit++;
+  return ow_bus_defer(bus, 70);
 }
 
 enum ow_device_operations {
@@ -269,7 +486,9 @@ enum ow_device_operations {
 enum ow_device_states {
   OW_DEVICE_IDLE = 0,
   OW_DEVICE_BUSY,
-  OW_DEVICE_WAIT
+  OW_DEVICE_WAIT,
+  OW_DEVICE_RECOVER,
+  OW_DEVICE_BACKOFF
 };
 
 const enum ow_device_operations OW_READ_ROM_OPERATIONS[] = {
@@ -301,56 +520,266 @@ struct ow_device {
   struct ow_bus *bus;
   enum ow_device_states state;
   uint_fast8_t operation_count;
-  const uint8_t *operations;
-  uint8_t *buffer; /* buffer for sending data, stores device address */
+  const enum ow_device_operations *operations;
+  /* transaction start, used to repeat it */
+  uint_fast8_t first_count;
+  const enum ow_device_operations *first_operation;
+  struct ow_retry_policy policy;
+  uint_fast8_t attempt;
+  uint8_t buffer[OW_DEVICE_BUFFER_SIZE]; /* data to send, device address */
   uint8_t *data_source;
   uint8_t *data_sink;
+  uint8_t *crc_data; /* received data checked when transaction ends */
+  uint_fast8_t crc_length;
   uint_fast8_t wait_value;
+#ifdef OW_ENABLE_STATS
+  struct ow_stats stats;
+  uint32_t start_time;
+  /* operations of the last transaction if it failed */
+  const enum ow_device_operations *failed_operation;
+#endif
+#ifdef OW_ENABLE_HISTORY
+  struct sh_buffer *history;
+#endif
 };
 
+/* Devices sharing a bus take it for the whole transaction, bus is
+   idle between operations and must not be used by others then. */
+static int_fast8_t ow_bus_claim(struct ow_bus *bus, struct ow_device *device) {
+#ifdef OW_THREAD_SAFE
+  struct ow_device *free_bus = NULL;
+  if (__atomic_compare_exchange_n(&(bus->owner), &free_bus, device, 0,
+				  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+#else
+  if (bus->owner == NULL) {
+    bus->owner = device;
+    return 0;
+  }
+#endif
+  OW_STATS_INC(bus, busy);
+  return -OW_ERROR_BUSY;
+}
+static void ow_bus_release(struct ow_bus *bus) {
+#ifdef OW_THREAD_SAFE
+  __atomic_store_n(&(bus->owner), NULL, __ATOMIC_RELEASE);
+#else
+  bus->owner = NULL;
+#endif
+}
+/* Release bus only if device still owns it. */
+static void ow_bus_release_owner(struct ow_bus *bus,
+				 struct ow_device *device) {
+#ifdef OW_THREAD_SAFE
+  __atomic_compare_exchange_n(&(bus->owner), &device, NULL, 0,
+			      __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+#else
+  if (bus->owner == device) {
+    bus->owner = NULL;
+  }
+#endif
+}
+
 /* Create and destruction. */
+#ifdef OW_DEVICE_POOL_SIZE
+OBJECT_POOL(ow_device, struct ow_device, OW_DEVICE_POOL_SIZE)
+#endif
 int_fast8_t ow_device_new(struct ow_device **device) {
-  int_fast8_t i;
   struct ow_device *new_device;
   if (device == NULL) return -1;
+#ifdef OW_DEVICE_POOL_SIZE
+  new_device = ow_device_pool_take();
+#else
   new_device = calloc(1, sizeof(struct ow_device));
+#endif
   if (new_device == NULL) return -1;
   new_device->refcount = 1;
   new_device->bus = NULL;
   new_device->state = OW_DEVICE_IDLE;
-  new_device->buffer = calloc(OW_DEVICE_BUFFER_SIZE, sizeof(uint8_t));
-  if (new_device->buffer == NULL) {
-    free(new_device);
-    return -1;
-  }
   *device = new_device;
   return 0;
 }
 struct ow_device *ow_device_ref(struct ow_device *device) {
-  if (device == NULL || device->bus == NULL) return NULL;
-  device->refcount++;
+  if (device == NULL) return NULL;
+  OW_REF_INC(device->refcount);
   return device;
 }
 struct ow_device *ow_device_unref(struct ow_device *device) {
   if (device == NULL) return NULL;
-  device->refcount--;
-  if (device->refcount > 0) return device;
+  if (OW_REF_DEC(device->refcount) > 0) return device;
   ow_device_free(device);
   return NULL;
 }
 void ow_device_free(struct ow_device *device) {
   if (device == NULL) return;
+  if (device->bus != NULL) {
+    /* freed in the middle of transaction */
+    ow_bus_release_owner(device->bus, device);
+  }
   ow_bus_unref(device->bus);
-  free(device->buffer);
+#ifdef OW_DEVICE_POOL_SIZE
+  ow_device_pool_give(device);
+#else
   free(device);
+#endif
 }
 
 int_fast8_t ow_device_set_bus(struct ow_device *device, struct ow_bus *bus) {
   if (device == NULL || bus == NULL || device->bus != NULL) return -1;
-  device->bus = bus;
+  device->bus = ow_bus_ref(bus);
   return 0;
 }
 
+int_fast8_t ow_device_set_retry_policy(struct ow_device *device,
+				       const struct ow_retry_policy *policy) {
+  if (device == NULL || policy == NULL) return -OW_ERROR;
+  device->policy = *policy;
+  return 0;
+}
+
+#ifdef OW_ENABLE_STATS
+const struct ow_stats *ow_device_get_stats(struct ow_device *device) {
+  if (device == NULL) return NULL;
+  return &(device->stats);
+}
+#endif
+
+#ifdef OW_ENABLE_HISTORY
+int_fast8_t ow_device_set_history(struct ow_device *device,
+				  struct sh_buffer *history) {
+  if (device == NULL) return -OW_ERROR;
+  device->history = history;
+  return 0;
+}
+#endif
+
+/* Start transaction made of given operations. */
+static int_fast8_t ow_device_begin(struct ow_device *device,
+				   const enum ow_device_operations *operations,
+				   uint_fast8_t operation_count,
+				   uint8_t *data_sink, uint_fast8_t crc_length) {
+  if (device->state != OW_DEVICE_IDLE) {
+    OW_STATS_INC(device, busy);
+    return -OW_ERROR_BUSY;
+  }
+  if (device->bus == NULL) return -OW_ERROR;
+  if (ow_bus_claim(device->bus, device) < 0) {
+    OW_STATS_INC(device, busy);
+    return -OW_ERROR_BUSY;
+  }
+  device->first_count = operation_count;
+  device->first_operation = operations;
+  device->operation_count = operation_count;
+  device->operations = operations;
+  device->data_source = device->buffer;
+  device->data_sink = data_sink;
+  device->crc_data = data_sink;
+  device->crc_length = crc_length;
+  device->attempt = 0;
+#ifdef OW_ENABLE_STATS
+  /* caller repeats the failed transaction */
+  if (device->failed_operation == operations) {
+    OW_STATS_INC(device, retries);
+  }
+  device->start_time = ow_bus_get_time(device->bus);
+#endif
+  return 1;
+}
+
+/* Run transaction again from the first operation. */
+static int_fast8_t ow_device_restart(struct ow_device *device) {
+  OW_STATS_INC(device, retries);
+  device->operation_count = device->first_count;
+  device->operations = device->first_operation;
+  device->data_source = device->buffer;
+  device->data_sink = device->crc_data;
+  return ow_device_start_operation(device);
+}
+
+/* Wait before next attempt, the wait doubles with every attempt. The
+   restart always happens from ow_device_continue, even without wait. */
+static int_fast8_t ow_device_backoff(struct ow_device *device) {
+  TD_TIMER_TYPE backoff = device->policy.backoff;
+  uint_fast8_t i;
+  for (i = 1; i < device->attempt && backoff < device->bus->timer->period / 4;
+       ++i) {
+    backoff <<= 1;
+  }
+  /* longer waits can not be measured by the bus timer */
+  if (backoff > device->bus->timer->period / 2) {
+    backoff = device->bus->timer->period / 2;
+  }
+  device->state = OW_DEVICE_BACKOFF;
+  return ow_bus_delay(device->bus, backoff);
+}
+
+/* Decide if failed attempt is repeated according to policy. */
+static int_fast8_t ow_device_retry(struct ow_device *device, int_fast8_t rc) {
+  if (device->attempt >= device->policy.attempts) return rc;
+  switch (rc) {
+  case -OW_ERROR_NO_RESPONSE:
+    if (!(device->policy.flags & OW_RETRY_NO_RESPONSE)) return rc;
+    break;
+  case -OW_ERROR_CRC:
+    if (!(device->policy.flags & OW_RETRY_CRC)) return rc;
+    break;
+  case -OW_ERROR_BUS_DOWN:
+    if (!(device->policy.flags & OW_RETRY_BUS_DOWN)) return rc;
+    device->attempt++;
+    device->state = OW_DEVICE_RECOVER;
+    rc = ow_bus_recover(device->bus);
+    if (rc == 0) return ow_device_backoff(device);
+    return rc;
+  default:
+    return rc;
+  }
+  device->attempt++;
+  return ow_device_backoff(device);
+}
+
+/* End transaction, received data is checked here. */
+static int_fast8_t ow_device_finish(struct ow_device *device, int_fast8_t rc) {
+  device->state = OW_DEVICE_IDLE;
+  if (rc == 0 && device->crc_length > 0
+      && ow_crc(device->crc_data, device->crc_length) != 0) {
+    rc = -OW_ERROR_CRC;
+  }
+#ifdef OW_ENABLE_STATS
+  ow_stats_count_error(&(device->stats), rc);
+#endif
+  if (rc < 0) {
+    rc = ow_device_retry(device, rc);
+    if (rc > 0) return rc;
+    device->state = OW_DEVICE_IDLE;
+  }
+  ow_bus_release(device->bus);
+#ifdef OW_ENABLE_HISTORY
+  /* samples are read from the caller scratchpad, nothing is copied */
+  if (rc == 0 && device->history != NULL
+      && device->first_operation == OW_READ_SCRATCHPAD_OPERATIONS) {
+    sh_record_scratchpad(device->history, device->crc_data);
+  }
+#endif
+#ifdef OW_ENABLE_STATS
+  device->failed_operation = rc < 0 ? device->first_operation : NULL;
+  device->stats.transactions++;
+  ow_stats_hit(device->stats.latency,
+	       (ow_bus_get_time(device->bus) - device->start_time)
+	       >> OW_STATS_LATENCY_SHIFT);
+#endif
+  return rc;
+}
+
+static int_fast8_t ow_device_next_operation(struct ow_device *device) {
+  device->operation_count--;
+  if (device->operation_count == 0) {
+    return ow_device_finish(device, 0);
+  }
+  device->operations++;
+  return ow_device_start_operation(device);
+}
+
 int_fast8_t ow_device_continue(struct ow_device *device) {
   int_fast8_t rc;
   switch (device->state) {
@@ -359,31 +788,40 @@ int_fast8_t ow_device_continue(struct ow_device *device) {
   case OW_DEVICE_BUSY:
     rc = ow_bus_continue(device->bus);
     if (rc == 0) {
-      device->operation_count--;
-      if (device->operation_count == 0) {
-	device->state = OW_DEVICE_IDLE;
-	return 0;
-      }
-      device->operations++;
-      return ow_device_start_operation(device);
+      return ow_device_next_operation(device);
     }
     if (rc < 0) {
-      device->state = OW_DEVICE_IDLE;
+      return ow_device_finish(device, rc);
     }
     return rc;
   case OW_DEVICE_WAIT:
-    rc = ow_bus_read_bit(device->bus);
-    if (rc == device->wait_value) {
-      device->operation_count--;
-      if (device->operation_count == 0) {
-	device->state = OW_DEVICE_IDLE;
-	return 0;
-      }
-      device->operations++;
-      return ow_device_start_operation(device);
+    rc = ow_bus_continue(device->bus);
+    if (rc < 0) {
+      return ow_device_finish(device, rc);
+    }
+    if (rc > 0) {
+      return rc;
+    }
+    if (ow_bus_read_bit(device->bus) == device->wait_value) {
+      return ow_device_next_operation(device);
+    }
+    return ow_bus_delay(device->bus, OW_DEVICE_POLL_INTERVAL);
+  case OW_DEVICE_RECOVER:
+    rc = ow_bus_continue(device->bus);
+    if (rc == 0) {
+      return ow_device_backoff(device);
     }
     if (rc < 0) {
-      device->state = OW_DEVICE_IDLE;
+      return ow_device_finish(device, rc);
+    }
+    return rc;
+  case OW_DEVICE_BACKOFF:
+    rc = ow_bus_continue(device->bus);
+    if (rc == 0) {
+      return ow_device_restart(device);
+    }
+    if (rc < 0) {
+      return ow_device_finish(device, rc);
     }
     return rc;
   default:
@@ -407,13 +845,18 @@ int_fast8_t ow_device_start_operation(struct ow_device *device) {
     device->data_sink++;
     break;
   case OW_DEVICE_OP_WAIT_1:
+    /* conversion takes up to 750 msec, the line is read once per
+       poll interval instead of every slot */
     device->wait_value = 1;
     device->state = OW_DEVICE_WAIT;
-    rc = 0;
+    rc = ow_bus_delay(device->bus, OW_DEVICE_POLL_INTERVAL);
+    break;
+  default:
+    rc = -OW_ERROR;
     break;
   }
   if (rc < 0) {
-    device->state = OW_DEVICE_IDLE;
+    return ow_device_finish(device, rc);
   }
   return rc;
 }
@@ -427,42 +870,201 @@ uint8_t *ow_device_get_address(struct ow_device *device) {
 }
 
 int_fast8_t  ow_device_read_rom(struct ow_device *device) {
-  if (device->state != OW_DEVICE_IDLE) {
-    return -OW_ERROR_BUSY;
-  }
-  device->operation_count = ARRAY_SIZE(OW_READ_ROM_OPERATIONS);
-  device->operations = OW_READ_ROM_OPERATIONS;
-  device->data_source = device->buffer;
+  int_fast8_t rc;
+  /* address is received in data_source[1] */
+  rc = ow_device_begin(device, OW_READ_ROM_OPERATIONS,
+		       ARRAY_SIZE(OW_READ_ROM_OPERATIONS),
+		       ow_device_get_address(device), OW_ADDRESS_LENGTH);
+  if (rc < 0) return rc;
   device->data_source[0] = 0x33; /* read rom operation code */
-  device->data_sink = ow_device_get_address(device); /* data_source[1] */
   return ow_device_start_operation(device);
 }
 
 int_fast8_t  ow_device_read_scratchpad(struct ow_device *device,
 				       uint8_t *scratchpad) {
-  if (device->state != OW_DEVICE_IDLE) {
-    return -OW_ERROR_BUSY;
-  }
-  device->operation_count = ARRAY_SIZE(OW_READ_SCRATCHPAD_OPERATIONS);
-  device->operations = OW_READ_SCRATCHPAD_OPERATIONS;
-  device->data_source = device->buffer;
+  int_fast8_t rc;
+  rc = ow_device_begin(device, OW_READ_SCRATCHPAD_OPERATIONS,
+		       ARRAY_SIZE(OW_READ_SCRATCHPAD_OPERATIONS),
+		       scratchpad, OW_SCRATCHPAD_LENGTH);
+  if (rc < 0) return rc;
   device->data_source[0] = 0x55; /* match rom */
   /* address must be stored in bytes 1...8 */
   device->data_source[OW_ADDRESS_LENGTH + 1] = 0xbe; /* read scratchpad */
-  device->data_sink = scratchpad;
   return ow_device_start_operation(device);
 }
 
 int_fast8_t  ow_device_convert_temperature(struct ow_device *device) {
-  if (device->state != OW_DEVICE_IDLE) {
-    return -OW_ERROR_BUSY;
-  }
-  device->operation_count = ARRAY_SIZE(OW_READ_CONVERT_TEMPERATURE_OPERATIONS);
-  device->operations = OW_READ_CONVERT_TEMPERATURE_OPERATIONS;
-  device->data_source = device->buffer;
+  int_fast8_t rc;
+  rc = ow_device_begin(device, OW_READ_CONVERT_TEMPERATURE_OPERATIONS,
+		       ARRAY_SIZE(OW_READ_CONVERT_TEMPERATURE_OPERATIONS),
+		       NULL, 0);
+  if (rc < 0) return rc;
   device->data_source[0] = 0x55; /* match rom */
   /* address must be stored in bytes 1...8 */
   device->data_source[OW_ADDRESS_LENGTH + 1] = 0x44; /* convert temp */
-  device->data_sink = NULL;
   return ow_device_start_operation(device);
 }
+
+/* Compiler barrier, keeps queue slot accesses on the right side of
+   index updates. */
+#ifndef OW_BARRIER
+#if defined(__GNUC__)
+#define OW_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define OW_BARRIER()
+#endif
+#endif
+
+/* Full fence between own index store and load of the other side's
+   index, release and acquire do not order a store before a load. */
+#ifdef OW_THREAD_SAFE
+#define OW_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define OW_FENCE() OW_BARRIER()
+#endif
+
+#define OW_ENGINE_QUEUE_MASK (OW_ENGINE_QUEUE_LENGTH - 1)
+
+/* Transactions go through one ring: main loop writes submitted and
+   collected, interrupt writes completed and active. Slots between
+   completed and submitted are pending, between collected and
+   completed hold results. */
+struct ow_engine {
+  int_fast8_t refcount;
+  struct ow_transaction queue[OW_ENGINE_QUEUE_LENGTH];
+  volatile uint_fast8_t submitted;
+  volatile uint_fast8_t completed;
+  volatile uint_fast8_t collected;
+  volatile uint_fast8_t active;
+};
+
+/* Indices of the other side are read with acquire and own ones are
+   written with release semantics, so slots are complete when seen. */
+static uint_fast8_t ow_engine_load(volatile uint_fast8_t *index) {
+#ifdef OW_THREAD_SAFE
+  return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#else
+  uint_fast8_t value = *index;
+  OW_BARRIER();
+  return value;
+#endif
+}
+static void ow_engine_store(volatile uint_fast8_t *index,
+			    uint_fast8_t value) {
+#ifdef OW_THREAD_SAFE
+  __atomic_store_n(index, value, __ATOMIC_RELEASE);
+#else
+  OW_BARRIER();
+  *index = value;
+#endif
+}
+
+/* Create and destruction. */
+#ifdef OW_ENGINE_POOL_SIZE
+OBJECT_POOL(ow_engine, struct ow_engine, OW_ENGINE_POOL_SIZE)
+#endif
+int_fast8_t ow_engine_new(struct ow_engine **engine) {
+  struct ow_engine *new_engine;
+  if (engine == NULL) return -OW_ERROR;
+#ifdef OW_ENGINE_POOL_SIZE
+  new_engine = ow_engine_pool_take();
+#else
+  new_engine = calloc(1, sizeof(struct ow_engine));
+#endif
+  if (new_engine == NULL) return -OW_ERROR;
+  new_engine->refcount = 1;
+  *engine = new_engine;
+  return 0;
+}
+struct ow_engine *ow_engine_ref(struct ow_engine *engine) {
+  if (engine == NULL) return NULL;
+  OW_REF_INC(engine->refcount);
+  return engine;
+}
+struct ow_engine *ow_engine_unref(struct ow_engine *engine) {
+  if (engine == NULL) return NULL;
+  if (OW_REF_DEC(engine->refcount) > 0) return engine;
+  ow_engine_free(engine);
+  return NULL;
+}
+void ow_engine_free(struct ow_engine *engine) {
+  if (engine == NULL) return;
+#ifdef OW_ENGINE_POOL_SIZE
+  ow_engine_pool_give(engine);
+#else
+  free(engine);
+#endif
+}
+
+int_fast8_t ow_engine_submit(struct ow_engine *engine,
+			     const struct ow_transaction *transaction) {
+  uint_fast8_t submitted;
+  if (engine == NULL || transaction == NULL || transaction->device == NULL) {
+    return -OW_ERROR;
+  }
+  submitted = engine->submitted;
+  /* a slot is reused only after its result was collected */
+  if ((uint_fast8_t)(submitted - engine->collected) >= OW_ENGINE_QUEUE_LENGTH) {
+    return -OW_ERROR_BUSY;
+  }
+  engine->queue[submitted & OW_ENGINE_QUEUE_MASK] = *transaction;
+  ow_engine_store(&(engine->submitted), submitted + 1);
+  OW_FENCE();
+  /* interrupt clears active before last look at the queue */
+  return ow_engine_load(&(engine->active)) ? 0 : 1;
+}
+
+int_fast8_t ow_engine_collect(struct ow_engine *engine,
+			      struct ow_transaction *transaction) {
+  uint_fast8_t collected;
+  if (engine == NULL || transaction == NULL) return -OW_ERROR;
+  collected = engine->collected;
+  if (collected == ow_engine_load(&(engine->completed))) {
+    return -OW_ERROR_NOOP;
+  }
+  *transaction = engine->queue[collected & OW_ENGINE_QUEUE_MASK];
+  ow_engine_store(&(engine->collected), collected + 1);
+  return 0;
+}
+
+static int_fast8_t ow_engine_start(struct ow_transaction *transaction) {
+  switch (transaction->type) {
+  case OW_TRANSACTION_READ_ROM:
+    return ow_device_read_rom(transaction->device);
+  case OW_TRANSACTION_READ_SCRATCHPAD:
+    return ow_device_read_scratchpad(transaction->device, transaction->data);
+  case OW_TRANSACTION_CONVERT_TEMPERATURE:
+    return ow_device_convert_temperature(transaction->device);
+  default:
+    return -OW_ERROR;
+  }
+}
+
+TD_TIMER_TYPE ow_engine_service(struct ow_engine *engine) {
+  int_fast8_t rc;
+  TD_TIMER_TYPE wait;
+  struct ow_transaction *current;
+  if (engine == NULL) return 0;
+  for (;;) {
+    current = &(engine->queue[engine->completed & OW_ENGINE_QUEUE_MASK]);
+    if (engine->active) {
+      rc = ow_device_continue(current->device);
+    } else {
+      if (engine->completed == ow_engine_load(&(engine->submitted))) {
+	return 0;
+      }
+      ow_engine_store(&(engine->active), 1);
+      rc = ow_engine_start(current);
+    }
+    if (rc > 0) {
+      wait = ow_bus_get_wait(current->device->bus);
+      return wait > 0 ? wait : 1;
+    }
+    current->rc = rc;
+    ow_engine_store(&(engine->completed), engine->completed + 1);
+    /* queue is checked again after active is cleared, so a
+       concurrent submit either sees idle engine or gets serviced */
+    ow_engine_store(&(engine->active), 0);
+    OW_FENCE();
+  }
+}
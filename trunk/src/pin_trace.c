@@ -0,0 +1,70 @@
+/* pin_trace.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file pin_trace.c
+  Recorder of timestamped pin events.
+*/
+
+#include <stdlib.h>
+
+#include "pin_trace.h"
+
+#define PT_BUFFER_MASK (PT_BUFFER_LENGTH - 1)
+
+int pt_init(struct pt_buffer *buffer, struct td_timer *timer) {
+  if (buffer == NULL || timer == NULL) {
+    return -1;
+  }
+  buffer->timer = timer;
+  return pt_clear(buffer);
+}
+
+int pt_clear(struct pt_buffer *buffer) {
+  if (buffer == NULL) {
+    return -1;
+  }
+  buffer->head = 0;
+  buffer->count = 0;
+  return 0;
+}
+
+void pt_record(struct pt_buffer *buffer, uint_fast8_t signal,
+	       uint_fast8_t value) {
+  struct pt_event *event;
+  event = &(buffer->events[buffer->head]);
+  event->time = buffer->timer->get_counter();
+  event->signal = signal;
+  event->value = value;
+  buffer->head = (buffer->head + 1) & PT_BUFFER_MASK;
+  if (buffer->count < PT_BUFFER_LENGTH) {
+    buffer->count++;
+  }
+}
+
+uint_fast16_t pt_get_count(const struct pt_buffer *buffer) {
+  return buffer->count;
+}
+
+const struct pt_event *pt_get_event(const struct pt_buffer *buffer,
+				    uint_fast16_t index) {
+  if (index >= buffer->count) {
+    return NULL;
+  }
+  return &(buffer->events[(buffer->head - buffer->count + index)
+			  & PT_BUFFER_MASK]);
+}
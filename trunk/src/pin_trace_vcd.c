@@ -0,0 +1,124 @@
+/* pin_trace_vcd.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file pin_trace_vcd.c
+  Value change dump export of pin traces, built for host only with
+  PT_ENABLE_VCD defined.
+*/
+
+#ifndef PT_ENABLE_VCD
+#define PT_ENABLE_VCD
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pin_trace.h"
+
+/* VCD identifiers are printable characters starting from '!'. */
+#define PT_VCD_MAX_SIGNALS (94)
+#define PT_VCD_ID(signal) ((char)('!' + (signal)))
+
+static unsigned long pt_time_delta(const struct td_timer *timer,
+				   TD_TIMER_TYPE previous,
+				   TD_TIMER_TYPE current) {
+  if (current >= previous) {
+    return current - previous;
+  }
+  return timer->period - previous + current;
+}
+
+/* Strobes end one tick after they were shown. */
+static void pt_vcd_end_strobes(FILE *out, char *strobed,
+			       uint_fast8_t name_count, unsigned long time) {
+  uint_fast8_t signal;
+  fprintf(out, "#%lu\n", time);
+  for (signal = 0; signal < name_count; ++signal) {
+    if (strobed[signal]) {
+      fprintf(out, "z%c\n", PT_VCD_ID(signal));
+      strobed[signal] = 0;
+    }
+  }
+}
+
+int pt_write_vcd(FILE *out, const struct pt_buffer *buffer,
+		 const char *const *names, uint_fast8_t name_count,
+		 const char *timescale) {
+  uint_fast16_t i, count;
+  uint_fast8_t signal;
+  const struct pt_event *event;
+  unsigned long time = 0, last_time = 0;
+  TD_TIMER_TYPE last_stamp = 0;
+  char strobed[PT_VCD_MAX_SIGNALS];
+  int strobe_pending = 0;
+  if (out == NULL || buffer == NULL || names == NULL
+      || name_count > PT_VCD_MAX_SIGNALS) {
+    return -1;
+  }
+  // header
+  fprintf(out, "$timescale %s $end\n", timescale);
+  fprintf(out, "$scope module trace $end\n");
+  for (signal = 0; signal < name_count; ++signal) {
+    if (names[signal] != NULL) {
+      fprintf(out, "$var wire 1 %c %s $end\n", PT_VCD_ID(signal),
+	      names[signal]);
+    }
+  }
+  fprintf(out, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+  for (signal = 0; signal < name_count; ++signal) {
+    if (names[signal] != NULL) {
+      fprintf(out, "x%c\n", PT_VCD_ID(signal));
+    }
+  }
+  fprintf(out, "$end\n");
+  // changes
+  memset(strobed, 0, sizeof(strobed));
+  count = pt_get_count(buffer);
+  for (i = 0; i < count; ++i) {
+    event = pt_get_event(buffer, i);
+    if (i > 0) {
+      time += pt_time_delta(buffer->timer, last_stamp, event->time);
+    }
+    last_stamp = event->time;
+    if (event->signal >= name_count || names[event->signal] == NULL) {
+      continue;
+    }
+    if (time > last_time) {
+      if (strobe_pending) {
+	pt_vcd_end_strobes(out, strobed, name_count, last_time + 1);
+	strobe_pending = 0;
+	if (last_time + 1 < time) {
+	  fprintf(out, "#%lu\n", time);
+	}
+      } else {
+	fprintf(out, "#%lu\n", time);
+      }
+    }
+    last_time = time;
+    fprintf(out, "%c%c\n", (event->value & 0x1) ? '1' : '0',
+	    PT_VCD_ID(event->signal));
+    if (event->value & PT_STROBE) {
+      strobed[event->signal] = 1;
+      strobe_pending = 1;
+    }
+  }
+  if (strobe_pending) {
+    pt_vcd_end_strobes(out, strobed, name_count, last_time + 1);
+  }
+  return 0;
+}
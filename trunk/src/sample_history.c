@@ -0,0 +1,179 @@
+/* sample_history.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file sample_history.c
+  Delta encoded history of timestamped temperature samples.
+*/
+
+#include <stdlib.h>
+
+#include "sample_history.h"
+
+#if SH_BUFFER_LENGTH < 16
+#error "SH_BUFFER_LENGTH is too small"
+#endif
+
+#define SH_BUFFER_MASK (SH_BUFFER_LENGTH - 1)
+/* 32 bit time delta and 17 bit zigzag value delta, 7 bits per byte */
+#define SH_MAX_RECORD (5 + 3)
+
+static TD_TIMER_TYPE sh_time_delta(const struct td_timer *timer,
+				   TD_TIMER_TYPE previous,
+				   TD_TIMER_TYPE current) {
+  if (current >= previous) {
+    return current - previous;
+  }
+  return timer->period - previous + current;
+}
+
+/* Varints hold 7 bits per byte, low bits first, high bit set in all
+   bytes but the last one. */
+static uint_fast8_t sh_put_varint(uint8_t *out, uint32_t value) {
+  uint_fast8_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+static uint32_t sh_get_varint(const struct sh_buffer *buffer,
+			      uint_fast16_t *position) {
+  uint32_t value = 0;
+  uint_fast8_t shift = 0;
+  uint8_t byte;
+  do {
+    byte = buffer->data[*position];
+    *position = (*position + 1) & SH_BUFFER_MASK;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+/* Apply record at position to sample, position moves past it. */
+static void sh_decode(const struct sh_buffer *buffer,
+		      uint_fast16_t *position, struct sh_sample *sample) {
+  uint32_t zigzag;
+  sample->time += sh_get_varint(buffer, position);
+  zigzag = sh_get_varint(buffer, position);
+  sample->value += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 0x1);
+}
+
+static uint_fast16_t sh_tail(const struct sh_buffer *buffer) {
+  return (buffer->head - buffer->used) & SH_BUFFER_MASK;
+}
+
+/* Oldest record becomes part of the base sample. */
+static void sh_drop_oldest(struct sh_buffer *buffer) {
+  uint_fast16_t position = sh_tail(buffer);
+  uint_fast16_t start = position;
+  sh_decode(buffer, &position, &(buffer->base));
+  buffer->used -= (position - start) & SH_BUFFER_MASK;
+  buffer->count--;
+}
+
+int sh_init(struct sh_buffer *buffer, struct td_timer *timer) {
+  if (buffer == NULL || timer == NULL) {
+    return -1;
+  }
+  buffer->timer = timer;
+  buffer->last_stamp = timer->get_counter();
+  buffer->newest.time = 0;
+  buffer->newest.value = 0;
+  return sh_clear(buffer);
+}
+
+int sh_clear(struct sh_buffer *buffer) {
+  if (buffer == NULL) {
+    return -1;
+  }
+  /* time keeps running, next sample is relative to the last one */
+  buffer->base = buffer->newest;
+  buffer->head = 0;
+  buffer->used = 0;
+  buffer->count = 0;
+  return 0;
+}
+
+int sh_record(struct sh_buffer *buffer, int16_t value) {
+  uint8_t record[SH_MAX_RECORD];
+  uint_fast8_t length, i;
+  TD_TIMER_TYPE stamp, delta;
+  int32_t change;
+  if (buffer == NULL) {
+    return -1;
+  }
+  stamp = buffer->timer->get_counter();
+  delta = sh_time_delta(buffer->timer, buffer->last_stamp, stamp);
+  change = (int32_t)value - buffer->newest.value;
+  length = sh_put_varint(record, delta);
+  length += sh_put_varint(record + length,
+			  ((uint32_t)change << 1) ^ (uint32_t)(change >> 31));
+  while (SH_BUFFER_LENGTH - buffer->used < length) {
+    sh_drop_oldest(buffer);
+  }
+  for (i = 0; i < length; ++i) {
+    buffer->data[buffer->head] = record[i];
+    buffer->head = (buffer->head + 1) & SH_BUFFER_MASK;
+  }
+  buffer->used += length;
+  buffer->count++;
+  buffer->last_stamp = stamp;
+  buffer->newest.time += delta;
+  buffer->newest.value = value;
+  return 0;
+}
+
+int sh_record_scratchpad(struct sh_buffer *buffer, const uint8_t *scratchpad) {
+  if (scratchpad == NULL) {
+    return -1;
+  }
+  /* temperature lsb and msb are the first scratchpad bytes */
+  return sh_record(buffer, (int16_t)(scratchpad[0] | (scratchpad[1] << 8)));
+}
+
+uint_fast16_t sh_get_count(const struct sh_buffer *buffer) {
+  return buffer->count;
+}
+
+uint_fast16_t sh_get_used(const struct sh_buffer *buffer) {
+  return buffer->used;
+}
+
+int sh_reader_init(struct sh_reader *reader, const struct sh_buffer *buffer) {
+  if (reader == NULL || buffer == NULL) {
+    return -1;
+  }
+  reader->buffer = buffer;
+  reader->position = sh_tail(buffer);
+  reader->left = buffer->count;
+  reader->sample = buffer->base;
+  return 0;
+}
+
+int sh_reader_next(struct sh_reader *reader, struct sh_sample *sample) {
+  if (reader->left == 0) {
+    return -1;
+  }
+  sh_decode(reader->buffer, &(reader->position), &(reader->sample));
+  reader->left--;
+  *sample = reader->sample;
+  return 0;
+}
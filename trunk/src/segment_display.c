@@ -20,10 +20,12 @@
   Library for 7 segment displays.
 */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "segment_display.h"
+#include "object_pool.h"
 
 static const unsigned char char_segment_patterns[] = {
   // numbers 0-F
@@ -35,29 +37,187 @@ static const unsigned char char_segment_patterns[] = {
   0x0, 0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80 
 };
 
+#define SD_DOT_PATTERN (0x80)
+
+// Format flags used inside, next to public enum sd_format_flags.
+#define SD_FORMAT_SIGNED (0x2)
+#define SD_FORMAT_HEX (0x4)
+
+// Port flag used inside: pin levels are unknown, next port refresh
+// writes every segment pin even with SD_PORT_DIFF.
+#define SD_PORT_FULL_WRITE (0x80)
+
+// Powers of ten used instead of division when printing numbers.
+static const unsigned decimal_powers[] = {
+  1, 10, 100, 1000, 10000,
+#if UINT_MAX > 0xffff
+  100000, 1000000, 10000000, 100000000, 1000000000
+#endif
+};
+
+#define SD_DECIMAL_DIGITS (sizeof(decimal_powers)/sizeof(decimal_powers[0]))
+#define SD_HEX_DIGITS (2*sizeof(unsigned))
+#define SD_NUMBER_DIGITS (SD_HEX_DIGITS > SD_DECIMAL_DIGITS \
+                          ? SD_HEX_DIGITS : SD_DECIMAL_DIGITS)
+#define SD_DIRTY_DIGITS (16)
+
+// Reference counts are atomic and front frame index is stored with
+// release and loaded with acquire in thread safe mode.
+#ifdef SD_THREAD_SAFE
+#if defined(SD_DISPLAY_POOL_SIZE) || defined(SD_SCHEDULER_POOL_SIZE)
+#error "static pools are not thread safe"
+#endif
+#define SD_REF_INC(count) __atomic_add_fetch(&(count), 1, __ATOMIC_RELAXED)
+#define SD_REF_DEC(count) __atomic_sub_fetch(&(count), 1, __ATOMIC_ACQ_REL)
+#define SD_LOAD_FRONT(display) __atomic_load_n(&(display)->front, \
+                                               __ATOMIC_ACQUIRE)
+#define SD_STORE_FRONT(display, value)                          \
+  __atomic_store_n(&(display)->front, (value), __ATOMIC_RELEASE)
+#else
+#define SD_REF_INC(count) (++(count))
+#define SD_REF_DEC(count) (--(count))
+#define SD_LOAD_FRONT(display) ((display)->front)
+// compiler barriers keep frame writes before the store on one core
+#define SD_STORE_FRONT(display, value)          \
+  do {                                          \
+    SD_BARRIER();                               \
+    (display)->front = (value);                 \
+    SD_BARRIER();                               \
+  } while (0)
+#endif
+
+#ifndef SD_BARRIER
+#if defined(__GNUC__)
+#define SD_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define SD_BARRIER()
+#endif
+#endif
+
+// Pin access, bound at compile time with SD_STATIC_PINS.
+#ifdef SD_STATIC_PINS
+#define SD_DIGIT_INIT(display, port, pin, cfg) SD_INIT_DIGIT(port, pin, cfg)
+#define SD_DIGIT_ON(display, port, pin) SD_TURN_ON_DIGIT(port, pin)
+#define SD_DIGIT_OFF(display, port, pin) SD_TURN_OFF_DIGIT(port, pin)
+#define SD_SEGMENT_INIT(display, port, pin, cfg) SD_INIT_SEGMENT(port, pin, cfg)
+#define SD_SEGMENT_ON(display, port, pin) SD_TURN_ON_SEGMENT(port, pin)
+#define SD_SEGMENT_OFF(display, port, pin) SD_TURN_OFF_SEGMENT(port, pin)
+#else
+#define SD_DIGIT_INIT(display, port, pin, cfg)  \
+  (display)->init_digit(port, pin, cfg)
+#define SD_DIGIT_ON(display, port, pin) (display)->turn_on_digit(port, pin)
+#define SD_DIGIT_OFF(display, port, pin) (display)->turn_off_digit(port, pin)
+#define SD_SEGMENT_INIT(display, port, pin, cfg)        \
+  (display)->init_segment(port, pin, cfg)
+#define SD_SEGMENT_ON(display, port, pin) (display)->turn_on_segment(port, pin)
+#define SD_SEGMENT_OFF(display, port, pin)      \
+  (display)->turn_off_segment(port, pin)
+#endif
+
+#ifdef SD_ENABLE_TRACE
+#define SD_TRACE(display, signal, value)                                \
+  do {                                                                  \
+    if ((display)->trace) {                                             \
+      pt_record((display)->trace, (display)->trace_signal + (signal),   \
+                (value));                                               \
+    }                                                                   \
+  } while (0)
+#else
+#define SD_TRACE(display, signal, value) do {} while (0)
+#endif
+#define SD_TRACE_SEGMENT(display, seg, value)                   \
+  SD_TRACE(display, (display)->digit_count + (seg), value)
+
+#ifdef SD_ENABLE_SHIFT_REGISTER
+#define SD_SHIFT_BURST_LENGTH (1 + SD_SHIFT_DIGIT_BYTES)
+
+enum sd_shift_modes {
+  SD_SHIFT_OFF = 0,
+  SD_SHIFT_BURST,
+  SD_SHIFT_BITBANG
+};
+#endif
+
 struct sd_display {
   int_fast8_t refcount;
   int_fast8_t digit_count;
   int_fast8_t current_digit;
   int_fast8_t dot_position;
-  enum sd_character *displayed_data;
-  struct sd_segment *digit_pin_map;
-  struct sd_segment *segment_pin_map;
+  uint16_t dirty; // back frame digits changed since last sd_publish
+  // two frames of segment patterns, refresh reads the front one
+  uint8_t frames[2*SD_MAX_DIGITS];
+  volatile uint_fast8_t front;
+  enum sd_character *initial_data; // connected before digit map was set
+  struct sd_segment digit_pin_map[SD_MAX_DIGITS];
+  struct sd_segment segment_pin_map[SD_SEGMENTS_PER_DIGIT];
   
+#ifndef SD_STATIC_PINS
   void (*init_digit)(sd_port_t, sd_pin_t, sd_pin_config_t);
   void (*turn_on_digit)(sd_port_t, sd_pin_t);
   void (*turn_off_digit)(sd_port_t, sd_pin_t);
   void (*init_segment)(sd_port_t, sd_pin_t, sd_pin_config_t);
   void (*turn_on_segment)(sd_port_t, sd_pin_t);
   void (*turn_off_segment)(sd_port_t, sd_pin_t);
+#endif
+#ifdef SD_ENABLE_TRACE
+  struct pt_buffer *trace;
+  uint_fast8_t trace_signal;
+#endif
+#ifdef SD_ENABLE_PORT_MASKS
+  // port mask refresh, used when write_port is set
+  void (*write_port)(sd_port_t, sd_port_mask_t, sd_port_mask_t);
+  uint_fast8_t port_flags;
+  uint_fast8_t segment_port_count;
+  sd_port_t segment_ports[SD_MAX_SEGMENT_PORTS];
+  sd_port_mask_t segment_port_pins[SD_MAX_SEGMENT_PORTS];
+  sd_port_mask_t shown_masks[SD_MAX_SEGMENT_PORTS];
+  // port masks for low and high halves of segment pattern
+  sd_port_mask_t low_masks[16][SD_MAX_SEGMENT_PORTS];
+  sd_port_mask_t high_masks[16][SD_MAX_SEGMENT_PORTS];
+#endif
+#ifdef SD_ENABLE_BRIGHTNESS
+  // per digit levels followed by levels scaled with global one
+  uint8_t brightness[2*SD_MAX_DIGITS];
+  uint_fast8_t global_brightness;
+  uint_fast8_t slice_end; // first bit of the next slice
+  uint_fast8_t digit_lit;
+  TD_TIMER_TYPE brightness_unit;
+  TD_TIMER_TYPE next_delay;
+#endif
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  // shift register refresh, used when shift_mode is not SD_SHIFT_OFF
+  void (*shift_out)(const uint8_t *, uint_fast8_t);
+  struct sd_segment shift_pins[SD_SHIFT_PIN_COUNT];
+  uint_fast8_t shift_mode;
+  uint_fast8_t shift_flags;
+  // segment bytes for low and high halves of segment pattern
+  uint8_t shift_low[16];
+  uint8_t shift_high[16];
+#endif
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  // transposed frames, bit n of column s is segment s of digit n
+  uint16_t columns[2][SD_SEGMENTS_PER_DIGIT];
+  uint_fast8_t scan_mode;
+  int_fast8_t current_segment;
+#endif
 };
 
 void sd_init_plug(sd_port_t port, sd_pin_t pin, sd_pin_config_t cfg) {}
 void sd_onoff_plug(sd_port_t port, sd_pin_t pin) {}
 
+#ifdef SD_DISPLAY_POOL_SIZE
+// Objects come from a static pool when its size is configured, see
+// object_pool.h.
+OBJECT_POOL(sd_display, struct sd_display, SD_DISPLAY_POOL_SIZE)
+#endif
+
 int sd_new(struct sd_display **display) {
   struct sd_display *new_display;
+#ifdef SD_DISPLAY_POOL_SIZE
+  new_display = sd_display_pool_take();
+#else
   new_display = calloc(1, sizeof(struct sd_display));
+#endif
   if (!new_display) {
     return -1;
   }
@@ -66,14 +226,12 @@ int sd_new(struct sd_display **display) {
   new_display->digit_count = -1;
   new_display->current_digit = 0;
   new_display->dot_position = -1;
-  new_display->displayed_data = NULL;
-  new_display->digit_pin_map = NULL;
-  new_display->segment_pin_map = calloc(SD_SEGMENTS_PER_DIGIT,
-                                        sizeof(struct sd_segment));
-  if (!new_display->segment_pin_map) {
-    sd_free(new_display);
-    return -1;
-  }
+#ifdef SD_ENABLE_BRIGHTNESS
+  new_display->global_brightness = SD_BRIGHTNESS_MAX;
+  new_display->slice_end = SD_BRIGHTNESS_BITS;
+  new_display->brightness_unit = 1;
+#endif
+#ifndef SD_STATIC_PINS
   // plug function pointers
   new_display->init_digit = sd_init_plug;
   new_display->turn_on_digit = sd_onoff_plug;
@@ -81,6 +239,7 @@ int sd_new(struct sd_display **display) {
   new_display->init_segment = sd_init_plug;
   new_display->turn_on_segment = sd_onoff_plug;
   new_display->turn_off_segment = sd_onoff_plug;
+#endif
   // object constructed
   *display = new_display;
   return 0;
@@ -90,7 +249,7 @@ struct sd_display *sd_ref(struct sd_display *display) {
   if (display == NULL) {
     return NULL;
   }
-  display->refcount++;
+  SD_REF_INC(display->refcount);
   return display;
 }
 
@@ -98,8 +257,7 @@ struct sd_display *sd_unref(struct sd_display *display) {
   if (display == NULL) {
     return NULL;
   }
-  display->refcount--;
-  if (display->refcount > 0) {
+  if (SD_REF_DEC(display->refcount) > 0) {
     return display;
   }
   sd_free(display);
@@ -110,10 +268,11 @@ void sd_free(struct sd_display *display) {
   if (display == NULL) {
     return;
   }
-  free(display->displayed_data);
-  free(display->digit_pin_map);
-  free(display->segment_pin_map);
+#ifdef SD_DISPLAY_POOL_SIZE
+  sd_display_pool_give(display);
+#else
   free(display);
+#endif
 }
 
 int sd_set_digit_functions(
@@ -125,9 +284,11 @@ int sd_set_digit_functions(
       || turn_off_digit == NULL) {
     return -1;
   }
+#ifndef SD_STATIC_PINS
   display->init_digit = init_digit;
   display->turn_on_digit = turn_on_digit;
   display->turn_off_digit = turn_off_digit;
+#endif
   return 0;
 }
 
@@ -140,36 +301,180 @@ int sd_set_segment_functions(
       || turn_off_segment == NULL) {
     return -1;
   }
+#ifndef SD_STATIC_PINS
   display->init_segment = init_segment;
   display->turn_on_segment = turn_on_segment;
   display->turn_off_segment = turn_off_segment;
+#endif
   return 0;
 }
 
+// Digits past the tracked ones share the last bit.
+static uint16_t sd_dirty_bit(int_fast8_t digit) {
+  return (uint16_t)1 << (digit < SD_DIRTY_DIGITS ? digit
+                         : SD_DIRTY_DIGITS - 1);
+}
+
+static void sd_mark_dirty(struct sd_display *display, int_fast8_t digit) {
+  display->dirty |= sd_dirty_bit(digit);
+}
+
 int sd_set_digit_map(struct sd_display *display, int_fast8_t digit_count,
                      const struct sd_segment *digit_map) {
-  int i;
-  /* if (display == NULL || digit_map == NULL || digit_count <= 0) { */
-  /*   return -1; */
-  /* } */
-  //assert(display->digit_pin_map == NULL);
-  display->digit_pin_map = calloc(digit_count, sizeof(struct sd_segment));
-  if (!display->digit_pin_map) {
+  if (display == NULL || digit_map == NULL || digit_count <= 0
+      || digit_count > SD_MAX_DIGITS) {
     return -1;
   }
-  /* display->displayed_data = calloc(digit_count, sizeof(enum sd_character)); */
-  /* if (!display->displayed_data) { */
-  /*   return -1; */
-  /* } */
+  // frame layout depends on digit count
+  memset(display->frames, 0, sizeof(display->frames));
+  display->dirty = 0;
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  memset(display->columns, 0, sizeof(display->columns));
+#endif
+#ifdef SD_ENABLE_PORT_MASKS
+  display->port_flags |= SD_PORT_FULL_WRITE;
+#endif
+#ifdef SD_ENABLE_BRIGHTNESS
+  memset(display->brightness, SD_BRIGHTNESS_MAX, sizeof(display->brightness));
+#endif
   display->digit_count = digit_count;
+  display->current_digit = 0;
+  display->front = 0;
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  display->current_segment = 0;
+#endif
   memcpy(display->digit_pin_map, digit_map,
          digit_count*sizeof(struct sd_segment));
-  for (i = 0; i < digit_count; ++i) {
-    display->displayed_data[i] = SD_SEGMENT_NONE;
+#ifdef SD_ENABLE_BRIGHTNESS
+  display->slice_end = SD_BRIGHTNESS_BITS;
+  sd_set_brightness(display, -1, display->global_brightness);
+#endif
+  // dot is kept, it goes to the back frame and is published with data
+  if (display->dot_position >= 0 && display->dot_position < digit_count) {
+    display->frames[digit_count + display->dot_position] = SD_DOT_PATTERN;
+    sd_mark_dirty(display, display->dot_position);
+  }
+  if (display->initial_data != NULL) {
+    sd_connect_display_to_data(display, display->initial_data);
+    display->initial_data = NULL;
+  } else {
+    sd_publish(display);
+  }
+  return 0;
+}
+
+#ifdef SD_ENABLE_PORT_MASKS
+// Split segment pins by ports and make per character port masks.
+static int sd_update_port_masks(struct sd_display *display) {
+  int seg, p;
+  unsigned half;
+  const struct sd_segment *segment;
+  display->segment_port_count = 0;
+  memset(display->segment_port_pins, 0, sizeof(display->segment_port_pins));
+  memset(display->low_masks, 0, sizeof(display->low_masks));
+  memset(display->high_masks, 0, sizeof(display->high_masks));
+  for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
+    segment = &(display->segment_pin_map[seg]);
+    for (p = 0; p < display->segment_port_count; ++p) {
+      if (display->segment_ports[p] == segment->port) {
+        break;
+      }
+    }
+    if (p == display->segment_port_count) {
+      if (p == SD_MAX_SEGMENT_PORTS) {
+        // too many ports, refresh goes back to per pin functions
+        display->segment_port_count = 0;
+        display->write_port = NULL;
+        return -1;
+      }
+      display->segment_ports[p] = segment->port;
+      display->segment_port_count++;
+    }
+    display->segment_port_pins[p] |= (sd_port_mask_t)segment->pin;
+    for (half = 0; half < 16; ++half) {
+      if (seg < 4 && (half & (1 << seg))) {
+        display->low_masks[half][p] |= (sd_port_mask_t)segment->pin;
+      }
+      if (seg >= 4 && (half & (1 << (seg - 4)))) {
+        display->high_masks[half][p] |= (sd_port_mask_t)segment->pin;
+      }
+    }
+  }
+  display->port_flags |= SD_PORT_FULL_WRITE;
+  return 0;
+}
+
+int sd_set_port_function(
+    struct sd_display *display,
+    void (*write_port)(sd_port_t, sd_port_mask_t, sd_port_mask_t),
+    uint_fast8_t flags) {
+  if (display == NULL) {
+    return -1;
+  }
+  display->write_port = write_port;
+  display->port_flags = flags;
+  if (write_port == NULL) {
+    return 0;
+  }
+  return sd_update_port_masks(display);
+}
+#endif
+
+#ifdef SD_ENABLE_SHIFT_REGISTER
+// Make segment bytes from segment output numbers.
+static int sd_update_shift_masks(struct sd_display *display) {
+  int seg;
+  unsigned half;
+  uint8_t bit;
+  memset(display->shift_low, 0, sizeof(display->shift_low));
+  memset(display->shift_high, 0, sizeof(display->shift_high));
+  for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
+    if ((unsigned)display->segment_pin_map[seg].pin >= 8) {
+      return -1;
+    }
+    bit = 1 << (unsigned)display->segment_pin_map[seg].pin;
+    for (half = 0; half < 16; ++half) {
+      if (seg < 4 && (half & (1 << seg))) {
+        display->shift_low[half] |= bit;
+      }
+      if (seg >= 4 && (half & (1 << (seg - 4)))) {
+        display->shift_high[half] |= bit;
+      }
+    }
   }
   return 0;
 }
 
+int sd_set_shift_function(
+    struct sd_display *display,
+    void (*shift_out)(const uint8_t *, uint_fast8_t),
+    uint_fast8_t flags) {
+  if (display == NULL) {
+    return -1;
+  }
+  display->shift_out = shift_out;
+  display->shift_flags = flags;
+  if (shift_out == NULL) {
+    display->shift_mode = SD_SHIFT_OFF;
+    return 0;
+  }
+  display->shift_mode = SD_SHIFT_BURST;
+  return sd_update_shift_masks(display);
+}
+
+int sd_set_shift_pins(struct sd_display *display,
+                      const struct sd_segment *pins, uint_fast8_t flags) {
+  if (display == NULL || pins == NULL) {
+    return -1;
+  }
+  memcpy(display->shift_pins, pins, sizeof(display->shift_pins));
+  display->shift_out = NULL;
+  display->shift_flags = flags;
+  display->shift_mode = SD_SHIFT_BITBANG;
+  return sd_update_shift_masks(display);
+}
+#endif
+
 int sd_set_segment_map(struct sd_display *display,
                        const struct sd_segment *segment_map) {
   /* if (display == NULL || segment_map == NULL) { */
@@ -178,6 +483,17 @@ int sd_set_segment_map(struct sd_display *display,
   //assert(display->segment_pin_map == NULL);
   memcpy(display->segment_pin_map, segment_map,
          SD_SEGMENTS_PER_DIGIT*sizeof(struct sd_segment));
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    return sd_update_shift_masks(display);
+  }
+#endif
+#ifdef SD_ENABLE_PORT_MASKS
+  // masks are built once the display opts in with sd_set_port_function
+  if (display->write_port != NULL) {
+    return sd_update_port_masks(display);
+  }
+#endif
   return 0;
 }
 
@@ -190,98 +506,1065 @@ int sd_init(struct sd_display *display) {
   /* if (display->current_digit >= 0) { */
   /*   return -1; */
   /* } */
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode == SD_SHIFT_BITBANG) {
+    for (i = 0; i < SD_SHIFT_PIN_COUNT; ++i) {
+      SD_SEGMENT_INIT(display, display->shift_pins[i].port,
+                      display->shift_pins[i].pin,
+                      display->shift_pins[i].config);
+      SD_SEGMENT_OFF(display, display->shift_pins[i].port,
+                     display->shift_pins[i].pin);
+    }
+  }
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    // map pins are shift register outputs
+    return 0;
+  }
+#endif
   // init digits
   for (i = 0; i < display->digit_count; ++i) {
-    display->init_digit(display->digit_pin_map[i].port,
-                        display->digit_pin_map[i].pin,
-                        display->digit_pin_map[i].config);
+    SD_DIGIT_INIT(display, display->digit_pin_map[i].port,
+                  display->digit_pin_map[i].pin,
+                  display->digit_pin_map[i].config);
   }
   // init segments
   for (i = 0; i < SD_SEGMENTS_PER_DIGIT; ++i) {
-    display->init_segment(display->segment_pin_map[i].port,
-                        display->segment_pin_map[i].pin,
-                        display->segment_pin_map[i].config);
+    SD_SEGMENT_INIT(display, display->segment_pin_map[i].port,
+                    display->segment_pin_map[i].pin,
+                    display->segment_pin_map[i].config);
   }
   return 0;
 }
 
-int sd_connect_display_to_data(struct sd_display *display, enum sd_character *data) {
-  /* if (display == NULL || display->digit_count <= 0) { */
-  /*   return -1; */
-  /* } */
-  /* memcpy(display->displayed_data, data,  */
-  /* 	 display->digit_count*sizeof(enum sd_character)); */
-  display->displayed_data = data;
+// Frame written by the main loop.
+static uint8_t *sd_back_frame(struct sd_display *display) {
+  return display->frames + (display->front ? 0 : display->digit_count);
+}
+
+// Frame shown by the refresh interrupt.
+static const uint8_t *sd_front_frame(struct sd_display *display) {
+  return display->frames + (SD_LOAD_FRONT(display) ? display->digit_count : 0);
+}
+
+int sd_set_segments(struct sd_display *display, int_fast8_t digit,
+                    uint8_t pattern) {
+  uint8_t *back;
+  if (display == NULL || display->digit_count <= 0
+      || digit < 0 || digit >= display->digit_count) {
+    return -1;
+  }
+  back = sd_back_frame(display);
+  if (back[digit] != pattern) {
+    back[digit] = pattern;
+    sd_mark_dirty(display, digit);
+  }
   return 0;
 }
 
+int sd_set_character(struct sd_display *display, int_fast8_t digit,
+                     enum sd_character ch) {
+  uint8_t pattern;
+  if (display == NULL || (unsigned)ch >= sizeof(char_segment_patterns)) {
+    return -1;
+  }
+  pattern = char_segment_patterns[ch];
+  if (digit == display->dot_position) {
+    pattern |= SD_DOT_PATTERN;
+  }
+  return sd_set_segments(display, digit, pattern);
+}
+
+#ifdef SD_ENABLE_SEGMENT_SCAN
+// Update columns of frame 0 or 1 for digits marked in dirty.
+static void sd_transpose(struct sd_display *display, uint_fast8_t frame,
+                         uint16_t dirty) {
+  const uint8_t *patterns;
+  uint16_t *columns = display->columns[frame];
+  uint16_t bit;
+  int_fast8_t i, seg;
+  patterns = display->frames + (frame ? display->digit_count : 0);
+  for (i = 0; i < display->digit_count && i < SD_SCAN_MAX_DIGITS; ++i) {
+    if (!(dirty & sd_dirty_bit(i))) {
+      continue;
+    }
+    bit = (uint16_t)1 << i;
+    for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
+      if (patterns[i] & (1 << seg)) {
+        columns[seg] |= bit;
+      } else {
+        columns[seg] &= ~bit;
+      }
+    }
+  }
+}
+#endif
+
+int sd_publish(struct sd_display *display) {
+  uint16_t dirty;
+  int_fast8_t i;
+  const uint8_t *front;
+  uint8_t *back;
+  if (display == NULL || display->digit_count <= 0) {
+    return -1;
+  }
+  // frames differ only in digits changed since the last publish
+  dirty = display->dirty;
+  if (dirty == 0) {
+    return 0;
+  }
+  display->dirty = 0;
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    sd_transpose(display, !display->front, dirty);
+  }
+#endif
+  // frame must be complete before it becomes visible
+  SD_STORE_FRONT(display, !display->front);
+  // next changes start from what is shown
+  front = sd_front_frame(display);
+  back = sd_back_frame(display);
+  for (i = 0; i < display->digit_count; ++i) {
+    if (dirty & sd_dirty_bit(i)) {
+      back[i] = front[i];
+    }
+  }
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    memcpy(display->columns[!display->front],
+           display->columns[display->front], sizeof(display->columns[0]));
+  }
+#endif
+  return 0;
+}
+
+int sd_connect_display_to_data(struct sd_display *display, enum sd_character *data) {
+  int_fast8_t i;
+  if (display == NULL || data == NULL) {
+    return -1;
+  }
+  if (display->digit_count <= 0) {
+    // shown once digit count is known
+    display->initial_data = data;
+    return 0;
+  }
+  for (i = 0; i < display->digit_count; ++i) {
+    sd_set_character(display, i, data[i]);
+  }
+  return sd_publish(display);
+}
+
 int sd_set_dot_position(struct sd_display *display, int_fast8_t pos) {
   if (display == NULL) {
     return -1;
   }
+  if (display->dot_position == pos) {
+    return 0;
+  }
+  if (display->digit_count > 0) {
+    uint8_t *back = sd_back_frame(display);
+    if (display->dot_position >= 0
+        && display->dot_position < display->digit_count) {
+      back[display->dot_position] &= ~SD_DOT_PATTERN;
+      sd_mark_dirty(display, display->dot_position);
+    }
+    if (pos >= 0 && pos < display->digit_count) {
+      back[pos] |= SD_DOT_PATTERN;
+      sd_mark_dirty(display, pos);
+    }
+  }
   display->dot_position = pos;
+  return 0;
 }
 
-int sd_show_next(struct sd_display *display) {
-  int seg;
-  unsigned char current_char;
+int_fast8_t sd_get_dot_position(struct sd_display *display) {
+  return display->dot_position;
+}
+
+int_fast8_t sd_get_scan_position(struct sd_display *display,
+                                 uint_fast8_t *moves) {
   if (display == NULL) {
     return -1;
   }
+  if (moves != NULL) {
+#ifdef SD_ENABLE_BRIGHTNESS
+    *moves = display->slice_end >= SD_BRIGHTNESS_BITS;
+#else
+    *moves = 1;
+#endif
+  }
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    return display->current_segment;
+  }
+#endif
+  return display->current_digit;
+}
+
+
+
+#ifdef SD_ENABLE_TRACE
+int sd_set_trace(struct sd_display *display, struct pt_buffer *trace,
+                 uint_fast8_t first_signal) {
+  if (display == NULL) {
+    return -1;
+  }
+  display->trace = trace;
+  display->trace_signal = first_signal;
+  return 0;
+}
+#endif
+
+#ifdef SD_ENABLE_BRIGHTNESS
+// Brightness of the current digit, global one in segment scan.
+static uint_fast8_t sd_current_level(struct sd_display *display) {
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    return display->global_brightness;
+  }
+#endif
+  return display->brightness[display->digit_count + display->current_digit];
+}
+#define SD_CURRENT_LIT(display) (sd_current_level(display) != 0)
+#else
+#define SD_CURRENT_LIT(display) (1)
+#endif
+
+#ifdef SD_ENABLE_PORT_MASKS
+// Write pins of one port, active low pins get set and reset swapped.
+static void sd_write_port(struct sd_display *display, sd_port_t port,
+                          sd_port_mask_t on, sd_port_mask_t off,
+                          uint_fast8_t active_low) {
+  if (active_low) {
+    display->write_port(port, off, on);
+  } else {
+    display->write_port(port, on, off);
+  }
+}
+
+// Refresh with one write per segment port plus digit switching.
+static int sd_show_next_ports(struct sd_display *display) {
+  int p;
+  sd_port_t digit_port;
+  sd_port_mask_t digit_pin, on, off, shown;
+  uint_fast8_t digits_low = display->port_flags & SD_DIGITS_ACTIVE_LOW;
+  uint_fast8_t digit_written = 0, lit;
+  const sd_port_mask_t *low, *high;
+  uint8_t pattern;
+  // turn off current digit
+  sd_write_port(display, display->digit_pin_map[display->current_digit].port,
+                0, (sd_port_mask_t)display->digit_pin_map[
+                    display->current_digit].pin, digits_low);
+  SD_TRACE(display, display->current_digit, 0);
+  // increment to next digit
+  display->current_digit = display->current_digit + 1;
+  if (display->current_digit == display->digit_count) {
+    display->current_digit = 0;
+  }
+  digit_port = display->digit_pin_map[display->current_digit].port;
+  digit_pin = (sd_port_mask_t)display->digit_pin_map[
+      display->current_digit].pin;
+  // digit of level 0 stays off
+  lit = SD_CURRENT_LIT(display);
+  digit_written = !lit;
+  // set segments, digit is turned on together with its port
+  pattern = sd_front_frame(display)[display->current_digit];
+  low = display->low_masks[pattern & 0xf];
+  high = display->high_masks[pattern >> 4];
+  for (p = 0; p < display->segment_port_count; ++p) {
+    on = low[p] | high[p];
+    off = display->segment_port_pins[p] & ~on;
+    shown = display->shown_masks[p];
+    display->shown_masks[p] = on;
+    if ((display->port_flags & (SD_PORT_DIFF | SD_PORT_FULL_WRITE))
+        == SD_PORT_DIFF) {
+      // touch only changed segments
+      on &= ~shown;
+      off &= shown;
+    }
+    if (display->port_flags & SD_SEGMENTS_ACTIVE_LOW) {
+      shown = on;
+      on = off;
+      off = shown;
+    }
+    if (lit && display->segment_ports[p] == digit_port) {
+      // segment pins and digit pin are on one port
+      if (digits_low) {
+        off |= digit_pin;
+      } else {
+        on |= digit_pin;
+      }
+      digit_written = 1;
+    }
+    if (on != 0 || off != 0) {
+      display->write_port(display->segment_ports[p], on, off);
+    }
+  }
+  display->port_flags &= ~SD_PORT_FULL_WRITE;
+  if (!digit_written) {
+    sd_write_port(display, digit_port, digit_pin, 0, digits_low);
+  }
+  SD_TRACE(display, display->current_digit, lit);
+#ifdef SD_ENABLE_TRACE
+  for (p = 0; p < SD_SEGMENTS_PER_DIGIT; ++p) {
+    SD_TRACE_SEGMENT(display, p, (pattern >> p) & 0x1);
+  }
+#endif
+  return 0;
+}
+#endif
+
+#ifdef SD_ENABLE_SHIFT_REGISTER
+// Clock bytes out MSB first and pulse latch.
+static void sd_shift_bitbang(struct sd_display *display,
+                             const uint8_t *data, uint_fast8_t length) {
+  const struct sd_segment *pins = display->shift_pins;
+  uint_fast8_t i;
+  uint8_t bit;
+  for (i = 0; i < length; ++i) {
+    for (bit = 0x80; bit != 0; bit >>= 1) {
+      if (data[i] & bit) {
+        SD_SEGMENT_ON(display, pins[SD_SHIFT_DATA].port,
+                      pins[SD_SHIFT_DATA].pin);
+      } else {
+        SD_SEGMENT_OFF(display, pins[SD_SHIFT_DATA].port,
+                       pins[SD_SHIFT_DATA].pin);
+      }
+      SD_SEGMENT_ON(display, pins[SD_SHIFT_CLOCK].port,
+                    pins[SD_SHIFT_CLOCK].pin);
+      SD_SEGMENT_OFF(display, pins[SD_SHIFT_CLOCK].port,
+                     pins[SD_SHIFT_CLOCK].pin);
+    }
+  }
+  SD_SEGMENT_ON(display, pins[SD_SHIFT_LATCH].port,
+                pins[SD_SHIFT_LATCH].pin);
+  SD_SEGMENT_OFF(display, pins[SD_SHIFT_LATCH].port,
+                 pins[SD_SHIFT_LATCH].pin);
+}
+
+// Segment byte of a segment pattern.
+static uint8_t sd_shift_segments(struct sd_display *display, uint8_t pattern) {
+  return display->shift_low[pattern & 0xf] | display->shift_high[pattern >> 4];
+}
+
+// Set output of a digit in digit bytes.
+static void sd_shift_set_digit(struct sd_display *display, uint8_t *digits,
+                               int_fast8_t digit) {
+  unsigned bit = (unsigned)display->digit_pin_map[digit].pin;
+  if (bit < 8*SD_SHIFT_DIGIT_BYTES) {
+    digits[SD_SHIFT_DIGIT_BYTES - 1 - (bit >> 3)] |= 1 << (bit & 0x7);
+  }
+}
+
+// Send segment and digit bytes in one burst.
+static void sd_shift_send(struct sd_display *display, uint8_t segments,
+                          const uint8_t *digits) {
+  uint8_t burst[SD_SHIFT_BURST_LENGTH];
+  uint8_t *out;
+  int i;
+  if (display->shift_flags & SD_SEGMENTS_ACTIVE_LOW) {
+    segments = ~segments;
+  }
+  if (display->shift_flags & SD_SHIFT_DIGITS_FIRST) {
+    out = burst;
+    burst[SD_SHIFT_DIGIT_BYTES] = segments;
+  } else {
+    burst[0] = segments;
+    out = burst + 1;
+  }
+  for (i = 0; i < SD_SHIFT_DIGIT_BYTES; ++i) {
+    out[i] = (display->shift_flags & SD_DIGITS_ACTIVE_LOW)
+        ? ~digits[i] : digits[i];
+  }
+  if (display->shift_mode == SD_SHIFT_BURST) {
+    display->shift_out(burst, SD_SHIFT_BURST_LENGTH);
+  } else {
+    sd_shift_bitbang(display, burst, SD_SHIFT_BURST_LENGTH);
+  }
+}
+
+// Send segments of current digit, digit is dark if not lit.
+static void sd_shift_show(struct sd_display *display, uint_fast8_t lit) {
+  uint8_t digits[SD_SHIFT_DIGIT_BYTES];
+  memset(digits, 0, sizeof(digits));
+  if (lit) {
+    sd_shift_set_digit(display, digits, display->current_digit);
+  }
+  sd_shift_send(display, sd_shift_segments(
+      display, sd_front_frame(display)[display->current_digit]), digits);
+}
+
+// Refresh with one burst, previous digit goes off at the same latch.
+static int sd_show_next_shift(struct sd_display *display) {
+  SD_TRACE(display, display->current_digit, 0);
+  display->current_digit = display->current_digit + 1;
+  if (display->current_digit == display->digit_count) {
+    display->current_digit = 0;
+  }
+  sd_shift_show(display, SD_CURRENT_LIT(display));
+  SD_TRACE(display, display->current_digit, SD_CURRENT_LIT(display));
+#ifdef SD_ENABLE_TRACE
+  {
+    int seg;
+    uint8_t pattern = sd_front_frame(display)[display->current_digit];
+    for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
+      SD_TRACE_SEGMENT(display, seg, (pattern >> seg) & 0x1);
+    }
+  }
+#endif
+  return 0;
+}
+#endif
+
+#ifdef SD_ENABLE_SEGMENT_SCAN
+int sd_set_scan_mode(struct sd_display *display, uint_fast8_t mode) {
+  int i;
+  if (display == NULL || display->digit_count <= 0
+      || mode > SD_SCAN_SEGMENTS
+      || (mode == SD_SCAN_SEGMENTS
+          && display->digit_count > SD_SCAN_MAX_DIGITS)) {
+    return -1;
+  }
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode == SD_SHIFT_OFF)
+#endif
+  {
+    // lines lit by the other mode are not touched by this one
+    for (i = 0; i < display->digit_count; ++i) {
+      SD_DIGIT_OFF(display, display->digit_pin_map[i].port,
+                   display->digit_pin_map[i].pin);
+    }
+    for (i = 0; i < SD_SEGMENTS_PER_DIGIT; ++i) {
+      SD_SEGMENT_OFF(display, display->segment_pin_map[i].port,
+                     display->segment_pin_map[i].pin);
+    }
+  }
+  if (mode == SD_SCAN_SEGMENTS) {
+    // later frames are updated by sd_publish from this one
+    memset(display->columns, 0, sizeof(display->columns));
+    sd_transpose(display, display->front ? 1 : 0, 0xffff);
+    memcpy(display->columns[display->front ? 0 : 1],
+           display->columns[display->front ? 1 : 0],
+           sizeof(display->columns[0]));
+  }
+#ifdef SD_ENABLE_PORT_MASKS
+  display->port_flags |= SD_PORT_FULL_WRITE;
+#endif
+  display->scan_mode = mode;
+  return 0;
+}
+
+static const uint16_t *sd_front_columns(struct sd_display *display) {
+  return display->columns[SD_LOAD_FRONT(display) ? 1 : 0];
+}
+
+// Turn current segment line on or off.
+static void sd_switch_segment(struct sd_display *display, uint_fast8_t on) {
+  const struct sd_segment *segment;
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    uint8_t digits[SD_SHIFT_DIGIT_BYTES];
+    uint16_t column = sd_front_columns(display)[display->current_segment];
+    int_fast8_t i;
+    memset(digits, 0, sizeof(digits));
+    for (i = 0; column != 0; ++i, column >>= 1) {
+      if (column & 0x1) {
+        sd_shift_set_digit(display, digits, i);
+      }
+    }
+    sd_shift_send(display, on ? sd_shift_segments(
+        display, 1 << display->current_segment) : 0, digits);
+  } else
+#endif
+  {
+    segment = &(display->segment_pin_map[display->current_segment]);
+    if (on) {
+      SD_SEGMENT_ON(display, segment->port, segment->pin);
+    } else {
+      SD_SEGMENT_OFF(display, segment->port, segment->pin);
+    }
+  }
+  SD_TRACE_SEGMENT(display, display->current_segment, on);
+}
+
+// Refresh one segment line of all digits.
+static int sd_show_next_segment(struct sd_display *display) {
+  int_fast8_t i;
+  uint16_t column;
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    // latch replaces previous segment line
+    SD_TRACE_SEGMENT(display, display->current_segment, 0);
+    display->current_segment = (display->current_segment + 1)
+        % SD_SEGMENTS_PER_DIGIT;
+    sd_switch_segment(display, SD_CURRENT_LIT(display));
+    return 0;
+  }
+#endif
+  sd_switch_segment(display, 0);
+  display->current_segment = (display->current_segment + 1)
+      % SD_SEGMENTS_PER_DIGIT;
+  column = sd_front_columns(display)[display->current_segment];
+  for (i = 0; i < display->digit_count; ++i) {
+    if (column & 0x1) {
+      SD_DIGIT_ON(display, display->digit_pin_map[i].port,
+                  display->digit_pin_map[i].pin);
+    } else {
+      SD_DIGIT_OFF(display, display->digit_pin_map[i].port,
+                   display->digit_pin_map[i].pin);
+    }
+    SD_TRACE(display, i, column & 0x1);
+    column >>= 1;
+  }
+  sd_switch_segment(display, SD_CURRENT_LIT(display));
+  return 0;
+}
+#endif
+
+#ifdef SD_ENABLE_BRIGHTNESS
+int sd_set_brightness(struct sd_display *display, int_fast8_t digit,
+                      uint_fast8_t level) {
+  int i;
+  uint8_t *levels, *scaled;
+  if (display == NULL || display->digit_count <= 0
+      || digit >= display->digit_count || level > SD_BRIGHTNESS_MAX) {
+    return -1;
+  }
+  levels = display->brightness;
+  scaled = display->brightness + display->digit_count;
+  if (digit >= 0) {
+    levels[digit] = level;
+  } else {
+    display->global_brightness = level;
+  }
+  // division is done here and not during refresh
+  for (i = 0; i < display->digit_count; ++i) {
+    scaled[i] = (levels[i]*display->global_brightness + SD_BRIGHTNESS_MAX/2)
+        / SD_BRIGHTNESS_MAX;
+  }
+  return 0;
+}
+
+int sd_set_brightness_unit(struct sd_display *display, TD_TIMER_TYPE unit) {
+  if (display == NULL || unit == 0) {
+    return -1;
+  }
+  display->brightness_unit = unit;
+  return 0;
+}
+
+TD_TIMER_TYPE sd_get_next_delay(struct sd_display *display) {
+  return display->next_delay;
+}
+#endif
+
+#if defined(SD_ENABLE_BRIGHTNESS) || defined(SD_ENABLE_SCHEDULER)
+// Turn current digit (or segment line in segment scan) on or off.
+static void sd_switch_digit(struct sd_display *display, uint_fast8_t on) {
+  const struct sd_segment *digit;
+#ifdef SD_ENABLE_BRIGHTNESS
+  display->digit_lit = on;
+#endif
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    sd_switch_segment(display, on);
+    return;
+  }
+#endif
+  digit = &(display->digit_pin_map[display->current_digit]);
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    sd_shift_show(display, on);
+  } else
+#endif
+#ifdef SD_ENABLE_PORT_MASKS
+  if (display->write_port != NULL) {
+    sd_write_port(display, digit->port, on ? (sd_port_mask_t)digit->pin : 0,
+                  on ? 0 : (sd_port_mask_t)digit->pin,
+                  display->port_flags & SD_DIGITS_ACTIVE_LOW);
+  } else
+#endif
+  if (on) {
+    SD_DIGIT_ON(display, digit->port, digit->pin);
+  } else {
+    SD_DIGIT_OFF(display, digit->port, digit->pin);
+  }
+  SD_TRACE(display, display->current_digit, on);
+}
+#endif
+
+#ifdef SD_ENABLE_BRIGHTNESS
+// Show next run of equal level bits: bit n lasts unit*2^n ticks.
+static int sd_show_slice(struct sd_display *display) {
+  uint_fast8_t level, start, end, lit;
+  level = sd_current_level(display);
+  start = display->slice_end;
+  lit = (level >> start) & 0x1;
+  for (end = start + 1; end < SD_BRIGHTNESS_BITS; ++end) {
+    if (((level >> end) & 0x1) != lit) {
+      break;
+    }
+  }
+  if (lit != display->digit_lit) {
+    sd_switch_digit(display, lit);
+  }
+  display->slice_end = end;
+  display->next_delay = display->brightness_unit
+      * (TD_TIMER_TYPE)((1 << end) - (1 << start));
+  return 0;
+}
+#endif
+
+// Refresh through per pin functions.
+static int sd_show_next_pins(struct sd_display *display) {
+  int seg;
+  unsigned char current_char;
   // turn off current digit
-  display->turn_off_digit(
+  SD_DIGIT_OFF(display,
            display->digit_pin_map[display->current_digit].port,
            display->digit_pin_map[display->current_digit].pin);
+  SD_TRACE(display, display->current_digit, 0);
   for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
-    display->turn_off_segment(
+    SD_SEGMENT_OFF(display,
            display->segment_pin_map[seg].port,
            display->segment_pin_map[seg].pin);  
+    SD_TRACE_SEGMENT(display, seg, 0);
   }
   // increment to next digit
   display->current_digit = display->current_digit + 1;
   if (display->current_digit == display->digit_count) {
     display->current_digit = 0;
   }
-  // show digit
-  display->turn_on_digit(
-           display->digit_pin_map[display->current_digit].port,
-           display->digit_pin_map[display->current_digit].pin);
-  current_char = char_segment_patterns[display->displayed_data[display->current_digit]];
+  // show digit, digit of level 0 stays off
+  if (SD_CURRENT_LIT(display)) {
+    SD_DIGIT_ON(display,
+             display->digit_pin_map[display->current_digit].port,
+             display->digit_pin_map[display->current_digit].pin);
+    SD_TRACE(display, display->current_digit, 1);
+  }
+  current_char = sd_front_frame(display)[display->current_digit];
   for (seg = 0; seg < SD_SEGMENTS_PER_DIGIT; ++seg) {
     if (current_char & 0x1) {
-      display->turn_on_segment(
+      SD_SEGMENT_ON(display,
            display->segment_pin_map[seg].port,
            display->segment_pin_map[seg].pin);  
+      SD_TRACE_SEGMENT(display, seg, 1);
     } else {
-      display->turn_off_segment(
+      SD_SEGMENT_OFF(display,
            display->segment_pin_map[seg].port,
            display->segment_pin_map[seg].pin);  
+      SD_TRACE_SEGMENT(display, seg, 0);
     }
     current_char >>=1;
   }
-  if (display->dot_position == display->current_digit) {
-    display->turn_on_segment(display->segment_pin_map[7].port,
-			     display->segment_pin_map[7].pin);
+  return 0;
+}
+
+int sd_show_next(struct sd_display *display) {
+  if (display == NULL) {
+    return -1;
   }
+#ifdef SD_ENABLE_BRIGHTNESS
+  if (display->slice_end < SD_BRIGHTNESS_BITS) {
+    return sd_show_slice(display);
+  }
+#endif
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    sd_show_next_segment(display);
+  } else
+#endif
+#ifdef SD_ENABLE_SHIFT_REGISTER
+  if (display->shift_mode != SD_SHIFT_OFF) {
+    sd_show_next_shift(display);
+  } else
+#endif
+#ifdef SD_ENABLE_PORT_MASKS
+  if (display->write_port != NULL) {
+    sd_show_next_ports(display);
+  } else {
+    sd_show_next_pins(display);
+  }
+#else
+  sd_show_next_pins(display);
+#endif
+#ifdef SD_ENABLE_BRIGHTNESS
+  display->digit_lit = SD_CURRENT_LIT(display);
+  display->slice_end = 0;
+  return sd_show_slice(display);
+#else
   return 0;
+#endif
 }
 
-int sd_display_uint(struct sd_display *display, int_fast8_t first_digit,
-		    int_fast8_t last_digit, unsigned value) {
+#ifdef SD_ENABLE_SCHEDULER
+struct sd_schedule_entry {
+  struct sd_display *display;
+  TD_TIMER_TYPE left;      // ticks till next call
+  TD_TIMER_TYPE slot_left; // ticks from next call till slot end
+  uint_fast8_t slot;
+};
+
+struct sd_scheduler {
+  int_fast8_t refcount;
+  uint_fast8_t display_count;
+  uint_fast8_t slots; // slots per frame, steps of the longest display
+  TD_TIMER_TYPE slot;
+  TD_TIMER_TYPE wait; // value returned by previous service call
+  struct sd_schedule_entry entries[SD_SCHEDULER_DISPLAYS];
+  // cpu cost, measured when clock is set
+  struct td_timer clock;
+  TD_TIMER_TYPE frame_time;
+  TD_TIMER_TYPE busy;
+  TD_TIMER_TYPE frame_cost;
+};
+
+#ifdef SD_SCHEDULER_POOL_SIZE
+OBJECT_POOL(sd_scheduler, struct sd_scheduler, SD_SCHEDULER_POOL_SIZE)
+#endif
+
+int sd_scheduler_new(struct sd_scheduler **scheduler) {
+  struct sd_scheduler *new_scheduler;
+#ifdef SD_SCHEDULER_POOL_SIZE
+  new_scheduler = sd_scheduler_pool_take();
+#else
+  new_scheduler = calloc(1, sizeof(struct sd_scheduler));
+#endif
+  if (!new_scheduler) {
+    return -1;
+  }
+  new_scheduler->refcount = 1;
+  new_scheduler->slot = 1;
+  *scheduler = new_scheduler;
+  return 0;
+}
+
+struct sd_scheduler *sd_scheduler_ref(struct sd_scheduler *scheduler) {
+  if (scheduler == NULL) {
+    return NULL;
+  }
+  SD_REF_INC(scheduler->refcount);
+  return scheduler;
+}
+
+struct sd_scheduler *sd_scheduler_unref(struct sd_scheduler *scheduler) {
+  if (scheduler == NULL) {
+    return NULL;
+  }
+  if (SD_REF_DEC(scheduler->refcount) > 0) {
+    return scheduler;
+  }
+  sd_scheduler_free(scheduler);
+  return NULL;
+}
+
+void sd_scheduler_free(struct sd_scheduler *scheduler) {
   uint_fast8_t i;
-  for (i = first_digit; i <= last_digit; ++i) {
-    display->displayed_data[i] = value % 10;
-    value /= 10;
+  if (scheduler == NULL) {
+    return;
+  }
+  for (i = 0; i < scheduler->display_count; ++i) {
+    sd_unref(scheduler->entries[i].display);
   }
+#ifdef SD_SCHEDULER_POOL_SIZE
+  sd_scheduler_pool_give(scheduler);
+#else
+  free(scheduler);
+#endif
+}
+
+// Refresh steps of one frame of a display.
+static uint_fast8_t sd_scheduler_steps(struct sd_display *display) {
+#ifdef SD_ENABLE_SEGMENT_SCAN
+  if (display->scan_mode == SD_SCAN_SEGMENTS) {
+    return SD_SEGMENTS_PER_DIGIT;
+  }
+#endif
+  return display->digit_count;
+}
+
+// Restart frames, slot starts of displays are spread over one slot.
+static void sd_scheduler_restart(struct sd_scheduler *scheduler) {
+  uint_fast8_t i;
+  struct sd_schedule_entry *entry;
+  scheduler->slots = 0;
+  for (i = 0; i < scheduler->display_count; ++i) {
+    entry = &(scheduler->entries[i]);
+    if (sd_scheduler_steps(entry->display) > scheduler->slots) {
+      scheduler->slots = sd_scheduler_steps(entry->display);
+    }
+#ifdef SD_ENABLE_BRIGHTNESS
+    if (scheduler->slot >= SD_BRIGHTNESS_MAX) {
+      sd_set_brightness_unit(entry->display,
+                             scheduler->slot / SD_BRIGHTNESS_MAX);
+    }
+#endif
+  }
+  for (i = 0; i < scheduler->display_count; ++i) {
+    entry = &(scheduler->entries[i]);
+    entry->left = (TD_TIMER_TYPE)((unsigned long)scheduler->slot * i
+                                  / scheduler->display_count);
+    entry->slot_left = 0;
+    entry->slot = scheduler->slots - 1;
+  }
+  scheduler->wait = 0;
+  scheduler->frame_time = 0;
+  scheduler->busy = 0;
+}
+
+int sd_scheduler_add(struct sd_scheduler *scheduler,
+                     struct sd_display *display) {
+  if (scheduler == NULL || display == NULL || display->digit_count <= 0
+      || scheduler->display_count == SD_SCHEDULER_DISPLAYS) {
+    return -1;
+  }
+  scheduler->entries[scheduler->display_count].display = sd_ref(display);
+  scheduler->display_count++;
+  sd_scheduler_restart(scheduler);
+  return 0;
+}
+
+int sd_scheduler_set_slot(struct sd_scheduler *scheduler, TD_TIMER_TYPE slot) {
+  if (scheduler == NULL || slot == 0) {
+    return -1;
+  }
+  scheduler->slot = slot;
+  sd_scheduler_restart(scheduler);
+  return 0;
+}
+
+int sd_scheduler_set_clock(struct sd_scheduler *scheduler,
+                           TD_TIMER_TYPE (*get_counter)(void),
+                           TD_TIMER_TYPE period) {
+  if (scheduler == NULL) {
+    return -1;
+  }
+  return td_init(&(scheduler->clock), get_counter, period);
+}
+
+TD_TIMER_TYPE sd_scheduler_get_frame_length(struct sd_scheduler *scheduler) {
+  return scheduler->slot*scheduler->slots;
+}
+
+TD_TIMER_TYPE sd_scheduler_get_frame_cost(struct sd_scheduler *scheduler) {
+  return scheduler->frame_cost;
+}
+
+// Make due call of one display, return ticks till its next call.
+static TD_TIMER_TYPE sd_scheduler_step(struct sd_scheduler *scheduler,
+                                       struct sd_schedule_entry *entry) {
+  struct sd_display *display = entry->display;
+  uint_fast8_t steps = sd_scheduler_steps(display);
+  TD_TIMER_TYPE next;
+  if (entry->slot_left == 0) {
+    // slot start: next digit, or dark if display is shorter than frame
+    entry->slot++;
+    if (entry->slot >= scheduler->slots) {
+      entry->slot = 0;
+    }
+    entry->slot_left = scheduler->slot;
+    if (entry->slot < steps) {
+#ifdef SD_ENABLE_BRIGHTNESS
+      // unfinished slices of previous digit are dropped
+      display->slice_end = SD_BRIGHTNESS_BITS;
+#endif
+      sd_show_next(display);
+    } else if (entry->slot == steps) {
+      sd_switch_digit(display, 0);
+    }
+  } else {
+    sd_show_next(display);
+  }
+  next = entry->slot_left;
+#ifdef SD_ENABLE_BRIGHTNESS
+  if (entry->slot < steps && display->slice_end < SD_BRIGHTNESS_BITS
+      && display->next_delay < next) {
+    next = display->next_delay;
+  }
+#endif
+  entry->slot_left -= next;
+  return next;
+}
+
+TD_TIMER_TYPE sd_scheduler_service(struct sd_scheduler *scheduler) {
+  uint_fast8_t i;
+  TD_TIMER_TYPE elapsed, wait;
+  struct sd_schedule_entry *entry;
+  if (scheduler == NULL || scheduler->display_count == 0) {
+    return 0;
+  }
+  if (scheduler->clock.get_counter != NULL) {
+    td_start(&(scheduler->clock));
+  }
+  elapsed = scheduler->wait;
+  wait = (TD_TIMER_TYPE)~0;
+  for (i = 0; i < scheduler->display_count; ++i) {
+    entry = &(scheduler->entries[i]);
+    if (entry->left <= elapsed) {
+      entry->left = sd_scheduler_step(scheduler, entry);
+    } else {
+      entry->left -= elapsed;
+    }
+    if (entry->left < wait) {
+      wait = entry->left;
+    }
+  }
+  scheduler->wait = wait;
+  if (scheduler->clock.get_counter != NULL) {
+    scheduler->busy += td_get_elapsed(&(scheduler->clock));
+    scheduler->frame_time += elapsed;
+    if (scheduler->frame_time >= sd_scheduler_get_frame_length(scheduler)) {
+      scheduler->frame_time -= sd_scheduler_get_frame_length(scheduler);
+      scheduler->frame_cost = scheduler->busy;
+      scheduler->busy = 0;
+    }
+  }
+  return wait;
+}
+#endif
+
+// Split value into decimal digits by subtracting powers of ten, at
+// most 9 subtractions per digit and no division. Return number of
+// significant digits.
+static uint_fast8_t sd_to_decimal(unsigned value, uint8_t *digits) {
+  int_fast8_t k;
+  uint_fast8_t d, count = 0;
+  for (k = SD_DECIMAL_DIGITS - 1; k >= 0; --k) {
+    d = 0;
+    while (value >= decimal_powers[k]) {
+      value -= decimal_powers[k];
+      d++;
+    }
+    digits[k] = d;
+    if (d != 0 && count == 0) {
+      count = k + 1;
+    }
+  }
+  return count;
+}
+
+static uint_fast8_t sd_to_hex(unsigned value, uint8_t *digits) {
+  uint_fast8_t k, count = 0;
+  for (k = 0; k < SD_HEX_DIGITS; ++k) {
+    digits[k] = value & 0xf;
+    value >>= 4;
+    if (digits[k] != 0) {
+      count = k + 1;
+    }
+  }
+  return count;
+}
+
+// Print magnitude into digits first..last, first is the least
+// significant one. Signed formats use one digit for sign: the last one
+// or, with SD_BLANK_ZEROS, the one right above the number.
+static int sd_format(struct sd_display *display, int_fast8_t first_digit,
+                     int_fast8_t last_digit, unsigned magnitude,
+                     uint_fast8_t negative, uint_fast8_t frac_digits,
+                     uint_fast8_t flags) {
+  uint8_t digits[SD_NUMBER_DIGITS];
+  uint_fast8_t count, i, width;
+  uint_fast8_t sign_pending = negative;
+  if (display == NULL || display->digit_count <= 0
+      || first_digit < 0 || last_digit >= display->digit_count
+      || first_digit > last_digit) {
+    return -1;
+  }
+  if (flags & SD_FORMAT_HEX) {
+    count = sd_to_hex(magnitude, digits);
+    memset(digits + SD_HEX_DIGITS, 0, SD_NUMBER_DIGITS - SD_HEX_DIGITS);
+  } else {
+    count = sd_to_decimal(magnitude, digits);
+    memset(digits + SD_DECIMAL_DIGITS, 0,
+           SD_NUMBER_DIGITS - SD_DECIMAL_DIGITS);
+  }
+  if (count <= frac_digits) {
+    count = frac_digits + 1; // keep zero in front of the dot
+  }
+  width = last_digit - first_digit + 1;
+  if ((flags & SD_FORMAT_SIGNED) && !(flags & SD_BLANK_ZEROS)) {
+    width--;
+    sd_set_character(display, last_digit,
+                     negative ? SD_CHARACTER_MINUS : SD_SEGMENT_NONE);
+    sign_pending = 0;
+  }
+  for (i = 0; i < width; ++i) {
+    if (i < count || !(flags & SD_BLANK_ZEROS)) {
+      sd_set_character(display, first_digit + i,
+                       i < SD_NUMBER_DIGITS ? digits[i] : SD_CHARACTER_ZERO);
+    } else if (sign_pending) {
+      sd_set_character(display, first_digit + i, SD_CHARACTER_MINUS);
+      sign_pending = 0;
+    } else {
+      sd_set_character(display, first_digit + i, SD_SEGMENT_NONE);
+    }
+  }
+  if (sign_pending) {
+    // no room left, sign replaces the most significant digit
+    sd_set_character(display, last_digit, SD_CHARACTER_MINUS);
+  }
+  return 0;
+}
+
+// Magnitude of a signed value, works for INT_MIN as well.
+static unsigned sd_magnitude(int value) {
+  if (value >= 0) {
+    return value;
+  }
+  return (unsigned)(-(value + 1)) + 1;
+}
+
+int sd_display_uint(struct sd_display *display, int_fast8_t first_digit,
+		    int_fast8_t last_digit, unsigned value) {
+  return sd_display_uint_ex(display, first_digit, last_digit, value, 0);
+}
+
+int sd_display_uint_ex(struct sd_display *display, int_fast8_t first_digit,
+                       int_fast8_t last_digit, unsigned value,
+                       uint_fast8_t flags) {
+  return sd_format(display, first_digit, last_digit, value, 0, 0,
+                   flags & SD_BLANK_ZEROS);
 }
 
 int sd_display_int(struct sd_display *display, int_fast8_t first_digit,
 		   int_fast8_t last_digit, int value) {
-  if (value >= 0) {
-    display->displayed_data[last_digit] = SD_SEGMENT_NONE;
-    return sd_display_uint(display, first_digit, last_digit - 1, value);
-  } else {
-    display->displayed_data[last_digit] = SD_CHARACTER_MINUS;
-    return sd_display_uint(display, first_digit, last_digit - 1, -value);
+  return sd_display_int_ex(display, first_digit, last_digit, value, 0);
+}
+
+int sd_display_int_ex(struct sd_display *display, int_fast8_t first_digit,
+                      int_fast8_t last_digit, int value,
+                      uint_fast8_t flags) {
+  return sd_format(display, first_digit, last_digit, sd_magnitude(value),
+                   value < 0, 0, (flags & SD_BLANK_ZEROS) | SD_FORMAT_SIGNED);
+}
+
+int sd_display_hex(struct sd_display *display, int_fast8_t first_digit,
+                   int_fast8_t last_digit, unsigned value,
+                   uint_fast8_t flags) {
+  return sd_format(display, first_digit, last_digit, value, 0, 0,
+                   (flags & SD_BLANK_ZEROS) | SD_FORMAT_HEX);
+}
+
+int sd_display_fixed(struct sd_display *display, int_fast8_t first_digit,
+                     int_fast8_t last_digit, int value,
+                     uint_fast8_t frac_digits, uint_fast8_t flags) {
+  int rc;
+  // integer part needs at least one digit
+  if (frac_digits >= last_digit - first_digit + 1) {
+    return -1;
+  }
+  rc = sd_format(display, first_digit, last_digit, sd_magnitude(value),
+                 value < 0, frac_digits,
+                 (flags & SD_BLANK_ZEROS) | SD_FORMAT_SIGNED);
+  if (rc < 0) {
+    return rc;
+  }
+  if (frac_digits) {
+    return sd_set_dot_position(display, first_digit + frac_digits);
   }
+  // dot of other numbers on the display is kept
+  if (display->dot_position >= first_digit
+      && display->dot_position <= last_digit) {
+    return sd_set_dot_position(display, -1);
+  }
+  return 0;
 }
@@ -0,0 +1,169 @@
+/* temperature_filter.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file temperature_filter.c
+  Incremental filtering of raw DS18B20 temperatures of many sensors.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "temperature_filter.h"
+
+#if TF_MEDIAN_LENGTH != 1 && TF_MEDIAN_LENGTH != 3 && TF_MEDIAN_LENGTH != 5
+#error "TF_MEDIAN_LENGTH must be 1, 3 or 5"
+#endif
+#if TF_AVERAGE_LENGTH & (TF_AVERAGE_LENGTH - 1)
+#error "TF_AVERAGE_LENGTH must be a power of 2"
+#endif
+
+#define TF_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define TF_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static void tf_clear_sensor(struct tf_bank *bank, uint_fast8_t sensor) {
+  bank->primed[sensor] = 0;
+  bank->rejected[sensor] = 0;
+  bank->last[sensor] = TF_NO_VALUE;
+  bank->output[sensor] = TF_NO_VALUE;
+}
+
+int tf_init(struct tf_bank *bank, uint_fast8_t sensor_count,
+	    int16_t max_step) {
+  uint_fast8_t i;
+  if (bank == NULL || sensor_count == 0 || sensor_count > TF_MAX_SENSORS
+      || max_step <= 0) {
+    return -1;
+  }
+  // update loops read windows and sums of unprimed sensors too
+  memset(bank, 0, sizeof(*bank));
+  bank->sensor_count = sensor_count;
+  bank->unprimed = sensor_count;
+  bank->max_step = max_step;
+  for (i = 0; i < sensor_count; ++i) {
+    tf_clear_sensor(bank, i);
+  }
+  return 0;
+}
+
+int tf_reset_sensor(struct tf_bank *bank, uint_fast8_t sensor) {
+  if (bank == NULL || sensor >= bank->sensor_count) {
+    return -1;
+  }
+  if (bank->primed[sensor]) {
+    bank->unprimed++;
+  }
+  tf_clear_sensor(bank, sensor);
+  return 0;
+}
+
+/* Fill windows of sensors that get their first acceptable value, the
+   value is then passed through the windows as usual. */
+static void tf_prime(struct tf_bank *bank, const int16_t *values) {
+  uint_fast8_t i, slot;
+  int16_t value;
+  for (i = 0; i < bank->sensor_count; ++i) {
+    value = values[i];
+    if (bank->primed[i] || value == TF_NO_VALUE
+	|| value == TF_POWER_ON_VALUE) {
+      continue;
+    }
+    for (slot = 0; slot < TF_MEDIAN_LENGTH; ++slot) {
+      bank->median[slot][i] = value;
+    }
+    for (slot = 0; slot < TF_AVERAGE_LENGTH; ++slot) {
+      bank->average[slot][i] = value;
+    }
+    bank->sum[i] = (int32_t)value * TF_AVERAGE_LENGTH;
+    bank->last[i] = value;
+    bank->primed[i] = 1;
+    bank->unprimed--;
+  }
+}
+
+int tf_update(struct tf_bank *bank, const int16_t *values) {
+  uint_fast8_t i, n;
+  int16_t *median_row, *average_row;
+  int32_t value, last, step, median, sum;
+  uint_fast8_t rejected, reject, missing;
+  if (bank == NULL || values == NULL) {
+    return -1;
+  }
+  n = bank->sensor_count;
+  if (bank->unprimed > 0) {
+    tf_prime(bank, values);
+  }
+  median_row = bank->median[bank->median_slot];
+  average_row = bank->average[bank->average_slot];
+  // two passes over all sensors, selects instead of branches and few
+  // enough arrays per pass for the compiler to vectorize them
+  for (i = 0; i < n; ++i) {
+    value = values[i];
+    last = bank->last[i];
+    rejected = bank->rejected[i];
+    step = value - last;
+    reject = step > bank->max_step || step < -bank->max_step;
+    reject = reject && (rejected < TF_REJECT_LIMIT
+			|| value == TF_POWER_ON_VALUE);
+    // missing reading keeps the last value and the reject count
+    missing = value == TF_NO_VALUE;
+    value = reject || missing ? last : value;
+    bank->rejected[i] = missing ? rejected
+      : reject ? TF_MIN(rejected + 1, 255) : 0;
+    bank->last[i] = (int16_t)value;
+    median_row[i] = (int16_t)value;
+  }
+  for (i = 0; i < n; ++i) {
+#if TF_MEDIAN_LENGTH == 1
+    median = bank->median[0][i];
+#elif TF_MEDIAN_LENGTH == 3
+    {
+      int32_t a = bank->median[0][i], b = bank->median[1][i],
+	c = bank->median[2][i];
+      median = TF_MAX(TF_MIN(a, b), TF_MIN(TF_MAX(a, b), c));
+    }
+#else
+    {
+      // median of 5 without sorting
+      int32_t a = bank->median[0][i], b = bank->median[1][i],
+	c = bank->median[2][i], d = bank->median[3][i],
+	e = bank->median[4][i], t, low, high, single;
+      t = TF_MIN(a, b); b = TF_MAX(a, b); a = t;
+      t = TF_MIN(c, d); d = TF_MAX(c, d); c = t;
+      // smaller of a and c has three larger values, it is dropped and
+      // the median is the second of the four left
+      low = TF_MAX(a, c);
+      high = a < c ? d : b;
+      single = a < c ? b : d;
+      t = TF_MIN(single, e); e = TF_MAX(single, e);
+      median = low < t ? TF_MIN(high, t) : TF_MIN(low, e);
+    }
+#endif
+    sum = bank->sum[i] + median - average_row[i];
+    average_row[i] = (int16_t)median;
+    bank->sum[i] = sum;
+    bank->output[i] = bank->primed[i] ? (int16_t)(sum / TF_AVERAGE_LENGTH)
+      : TF_NO_VALUE;
+  }
+  bank->median_slot = (bank->median_slot + 1) % TF_MEDIAN_LENGTH;
+  bank->average_slot = (bank->average_slot + 1) & (TF_AVERAGE_LENGTH - 1);
+  return 0;
+}
+
+const int16_t *tf_get_output(const struct tf_bank *bank) {
+  return bank->output;
+}
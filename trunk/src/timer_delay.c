@@ -18,6 +18,16 @@ int td_start(struct td_timer *timer) {
   return 0;
 }
 
+/* Ticks past stop, counter may have wrapped after the stop value. */
+static TD_TIMER_TYPE td_overshoot(struct td_timer *timer,
+				  TD_TIMER_TYPE current, TD_TIMER_TYPE stop) {
+  if (current >= stop) {
+    return current - stop;
+  } else {
+    return timer->period - stop + current;
+  }
+}
+
 int td_has_elapsed(struct td_timer *timer, TD_TIMER_TYPE delay) {
   TD_TIMER_TYPE stop, current;
   if (timer == 0) {
@@ -26,17 +36,17 @@ int td_has_elapsed(struct td_timer *timer, TD_TIMER_TYPE delay) {
   current = timer->get_counter();
   if (timer->period - timer->start > delay) {
     stop = timer->start + delay;
-    if (current < stop && current > timer->start) {
+    if (current < stop && current >= timer->start) {
       return 0;
     } else {
-      return current - stop;
+      return td_overshoot(timer, current, stop);
     }
   } else {
     stop = delay - (timer->period - timer->start);
-    if (current < stop || current > timer->start) {
+    if (current < stop || current >= timer->start) {
       return 0;
     } else {
-      return current - stop;
+      return td_overshoot(timer, current, stop);
     }
   }
 }
@@ -49,16 +59,16 @@ int td_wait(struct td_timer *timer, TD_TIMER_TYPE delay) {
   current = timer->get_counter();
   if (timer->period - timer->start > delay) {
     stop = timer->start + delay;
-    while (current < stop && current > timer->start) {
+    while (current < stop && current >= timer->start) {
       current = timer->get_counter();
     }
   } else {
     stop = delay - (timer->period - timer->start);
-    while (current < stop || current > timer->start) {
+    while (current < stop || current >= timer->start) {
       current = timer->get_counter();
     }
   }
-  return current - stop;
+  return td_overshoot(timer, current, stop);
 }
 
 TD_TIMER_TYPE td_get_elapsed(struct td_timer *timer) {
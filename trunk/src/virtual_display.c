@@ -0,0 +1,304 @@
+/* virtual_display.c
+ *
+ * Copyright (C) 2013 Alexey Naydenov <alexey.naydenovREMOVETHIS@linux.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file virtual_display.c
+  Virtual LED matrix for segment_display, built for host only.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "virtual_display.h"
+
+// Pin functions get no context, they switch this display.
+static struct vd_display *vd_current;
+
+static uint8_t vd_lit(const struct vd_display *display, int_fast8_t digit) {
+  return display->digit_on[digit] ? display->segments_on : 0;
+}
+
+int vd_init(struct vd_display *display, int_fast8_t digit_count,
+            const struct sd_segment *digit_map,
+            const struct sd_segment *segment_map,
+            uint32_t ticks_per_second) {
+  if (display == NULL || digit_map == NULL || segment_map == NULL
+      || digit_count <= 0 || digit_count > SD_MAX_DIGITS
+      || ticks_per_second == 0) {
+    return -1;
+  }
+  memset(display, 0, sizeof(*display));
+  display->digit_count = digit_count;
+  memcpy(display->digit_map, digit_map, digit_count*sizeof(*digit_map));
+  memcpy(display->segment_map, segment_map,
+         SD_SEGMENTS_PER_DIGIT*sizeof(*segment_map));
+  display->ticks_per_second = ticks_per_second;
+  return 0;
+}
+
+int vd_set_callback_cost(struct vd_display *display, uint32_t ticks) {
+  if (display == NULL) {
+    return -1;
+  }
+  display->callback_cost = ticks;
+  return 0;
+}
+
+int vd_attach(struct vd_display *display) {
+  vd_current = display;
+  return 0;
+}
+
+int vd_reset_metrics(struct vd_display *display) {
+  if (display == NULL) {
+    return -1;
+  }
+  display->time = 0;
+  display->callbacks = 0;
+  display->steps = 0;
+  display->frames = 0;
+  memset(display->leds, 0, sizeof(display->leds));
+  memset(display->step_time, 0, sizeof(display->step_time));
+  return 0;
+}
+
+void vd_advance(struct vd_display *display, uint32_t ticks) {
+  int_fast8_t digit;
+  uint_fast8_t segment;
+  uint8_t lit;
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    lit = vd_lit(display, digit);
+    for (segment = 0; lit != 0; ++segment, lit >>= 1) {
+      if (lit & 0x1) {
+        display->leds[digit][segment].on_time += ticks;
+        if (display->in_step) {
+          display->step_time[digit][segment] += ticks;
+        }
+      }
+    }
+  }
+  display->time += ticks;
+}
+
+// Called after every counted pin change.
+static void vd_pin_changed(struct vd_display *display) {
+  int_fast8_t digit;
+  if (display->in_step) {
+    for (digit = 0; digit < display->digit_count; ++digit) {
+      display->step_seen[digit] |= vd_lit(display, digit);
+    }
+  }
+  vd_advance(display, display->callback_cost);
+}
+
+static void vd_switch_digit(struct vd_display *display, sd_port_t port,
+                            sd_pin_t pin, uint8_t on) {
+  int_fast8_t digit;
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    if (display->digit_map[digit].port == port
+        && display->digit_map[digit].pin == pin) {
+      display->digit_on[digit] = on;
+    }
+  }
+}
+
+static void vd_switch_segment(struct vd_display *display, sd_port_t port,
+                              sd_pin_t pin, uint8_t on) {
+  uint_fast8_t segment;
+  for (segment = 0; segment < SD_SEGMENTS_PER_DIGIT; ++segment) {
+    if (display->segment_map[segment].port == port
+        && display->segment_map[segment].pin == pin) {
+      if (on) {
+        display->segments_on |= 1 << segment;
+      } else {
+        display->segments_on &= ~(1 << segment);
+      }
+    }
+  }
+}
+
+// Pins are dark after init, init calls are not counted.
+void vd_init_pin(sd_port_t port, sd_pin_t pin, sd_pin_config_t cfg) {
+  (void)cfg;
+  if (vd_current == NULL) {
+    return;
+  }
+  vd_switch_digit(vd_current, port, pin, 0);
+  vd_switch_segment(vd_current, port, pin, 0);
+}
+
+void vd_digit_on(sd_port_t port, sd_pin_t pin) {
+  if (vd_current == NULL) {
+    return;
+  }
+  vd_current->callbacks++;
+  vd_switch_digit(vd_current, port, pin, 1);
+  vd_pin_changed(vd_current);
+}
+
+void vd_digit_off(sd_port_t port, sd_pin_t pin) {
+  if (vd_current == NULL) {
+    return;
+  }
+  vd_current->callbacks++;
+  vd_switch_digit(vd_current, port, pin, 0);
+  vd_pin_changed(vd_current);
+}
+
+void vd_segment_on(sd_port_t port, sd_pin_t pin) {
+  if (vd_current == NULL) {
+    return;
+  }
+  vd_current->callbacks++;
+  vd_switch_segment(vd_current, port, pin, 1);
+  vd_pin_changed(vd_current);
+}
+
+void vd_segment_off(sd_port_t port, sd_pin_t pin) {
+  if (vd_current == NULL) {
+    return;
+  }
+  vd_current->callbacks++;
+  vd_switch_segment(vd_current, port, pin, 0);
+  vd_pin_changed(vd_current);
+}
+
+int vd_begin_step(struct vd_display *display) {
+  int_fast8_t digit;
+  if (display == NULL) {
+    return -1;
+  }
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    display->step_start[digit] = vd_lit(display, digit);
+    display->step_seen[digit] = display->step_start[digit];
+  }
+  memset(display->step_time, 0, sizeof(display->step_time));
+  display->in_step = 1;
+  return 0;
+}
+
+int vd_end_step(struct vd_display *display) {
+  int_fast8_t digit;
+  uint_fast8_t segment;
+  uint8_t end, ghosts, lit;
+  struct vd_led *led;
+  if (display == NULL || !display->in_step) {
+    return -1;
+  }
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    end = vd_lit(display, digit);
+    // lit only in the middle of the step
+    ghosts = display->step_seen[digit] & ~display->step_start[digit] & ~end;
+    lit = end & ~display->step_start[digit];
+    for (segment = 0; segment < SD_SEGMENTS_PER_DIGIT; ++segment) {
+      led = &(display->leds[digit][segment]);
+      if (ghosts & (1 << segment)) {
+        led->ghosts++;
+        led->ghost_time += display->step_time[digit][segment];
+      }
+      if (lit & (1 << segment)) {
+        led->lit_periods++;
+      }
+    }
+  }
+  display->in_step = 0;
+  display->steps++;
+  return 0;
+}
+
+int vd_show_next(struct vd_display *display, struct sd_display *source,
+                 uint32_t ticks) {
+  int rc;
+  uint_fast8_t moves;
+  if (sd_get_scan_position(source, &moves) < 0
+      || vd_begin_step(display) < 0) {
+    return -1;
+  }
+  rc = sd_show_next(source);
+  vd_end_step(display);
+  if (moves && sd_get_scan_position(source, NULL) == 0) {
+    display->frames++;
+  }
+  vd_advance(display, ticks);
+  return rc;
+}
+
+const struct vd_led *vd_get_led(const struct vd_display *display,
+                                int_fast8_t digit, uint_fast8_t segment) {
+  if (display == NULL || digit < 0 || digit >= display->digit_count
+      || segment >= SD_SEGMENTS_PER_DIGIT) {
+    return NULL;
+  }
+  return &(display->leds[digit][segment]);
+}
+
+int vd_get_metrics(const struct vd_display *display,
+                   struct vd_metrics *metrics) {
+  int_fast8_t digit;
+  uint_fast8_t segment;
+  const struct vd_led *led;
+  if (display == NULL || metrics == NULL) {
+    return -1;
+  }
+  memset(metrics, 0, sizeof(*metrics));
+  metrics->time = display->time;
+  metrics->callbacks = display->callbacks;
+  metrics->frames = display->frames;
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    for (segment = 0; segment < SD_SEGMENTS_PER_DIGIT; ++segment) {
+      led = &(display->leds[digit][segment]);
+      metrics->ghosts += led->ghosts;
+      metrics->ghost_time += led->ghost_time;
+    }
+  }
+  if (metrics->time > 0) {
+    metrics->refresh_rate = (double)metrics->frames
+      * display->ticks_per_second / metrics->time;
+  }
+  if (metrics->frames > 0) {
+    metrics->callbacks_per_frame = (double)metrics->callbacks
+      / metrics->frames;
+  }
+  return 0;
+}
+
+int vd_write_report(FILE *out, const struct vd_display *display) {
+  struct vd_metrics metrics;
+  int_fast8_t digit;
+  uint_fast8_t segment;
+  const struct vd_led *led;
+  if (out == NULL || vd_get_metrics(display, &metrics) < 0) {
+    return -1;
+  }
+  fprintf(out, "time %lu frames %lu refresh %.1f Hz callbacks/frame %.2f "
+          "ghosts %lu ghost time %lu\n", (unsigned long)metrics.time,
+          (unsigned long)metrics.frames, metrics.refresh_rate,
+          metrics.callbacks_per_frame, (unsigned long)metrics.ghosts,
+          (unsigned long)metrics.ghost_time);
+  // duty of segments A-G and DP in per mille
+  fprintf(out, "digit     A     B     C     D     E     F     G    DP\n");
+  for (digit = 0; digit < display->digit_count; ++digit) {
+    fprintf(out, "%5d", (int)digit);
+    for (segment = 0; segment < SD_SEGMENTS_PER_DIGIT; ++segment) {
+      led = &(display->leds[digit][segment]);
+      fprintf(out, " %5lu", metrics.time > 0 ? (unsigned long)
+              ((uint64_t)led->on_time * 1000 / metrics.time) : 0ul);
+    }
+    fprintf(out, "\n");
+  }
+  return 0;
+}